@@ -0,0 +1,48 @@
+#include "accelerationStructure.hpp"
+#include "bvh.hpp"
+
+object::Primitive::Collision AccelerationStructure::intersects(const Scene &scene, const Ray &incoming, Ray &outgoing, double &t, Color &color, Stats *stats) const
+{
+    object::Hit hit;
+    hit.mT = t;
+    if (!closestHit(scene, incoming, hit, stats))
+    {
+        return object::Primitive::Collision::MISSED;
+    }
+    t = hit.mT;
+    outgoing = incoming;
+    return scene.shade(hit, outgoing, color);
+}
+
+uint32_t AccelerationStructure::closestHitPacket(const Scene &scene, const Ray *rays, object::Hit *hits, int count, Stats *stats) const
+{
+    uint32_t mask = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (closestHit(scene, rays[i], hits[i], stats))
+        {
+            mask |= 1u << i;
+        }
+    }
+    return mask;
+}
+
+void AccelerationStructure::addStats(const Stats &stats)
+{
+    std::lock_guard<std::mutex> lock(mStatsLock);
+    mStats.mRays += stats.mRays;
+    mStats.mNodes += stats.mNodes;
+    mStats.mPrimitives += stats.mPrimitives;
+}
+
+double AccelerationStructure::measuredCost()
+{
+    std::lock_guard<std::mutex> lock(mStatsLock);
+    if (mStats.mRays == 0)
+    {
+        return 0;
+    }
+    return (BoundingVolumeHierarchy::sTraversalCost * mStats.mNodes +
+            BoundingVolumeHierarchy::sIntersectionCost * mStats.mPrimitives) /
+           mStats.mRays;
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include "ray.hpp"
+#include "scene.hpp"
+#include "color.hpp"
+
+/**
+ * @brief Ray queries against every primitive in a scene. Implemented by
+ * the binary FlatBoundingVolumeHierarchy and the wider
+ * WideBoundingVolumeHierarchy, so the renderer doesn't care which one
+ * it's tracing against.
+ */
+class AccelerationStructure
+{
+public:
+    // Traversal counters, used to measure the actual cost of a tree
+    struct Stats
+    {
+        uint64_t mRays = 0;       // Rays that hit the root node
+        uint64_t mNodes = 0;      // Interior nodes visited
+        uint64_t mPrimitives = 0; // Primitive intersection tests
+    };
+
+    static constexpr int sMaxPacketSize = 16; // Most rays closestHitPacket() takes at once
+
+    virtual ~AccelerationStructure() {}
+
+    /**
+     * @brief Find the closest primitive a ray hits, without shading it.
+     *
+     * @param scene Scene the primitive references point into
+     * @param hit Closest hit. hit.mT has to be set to the max time to
+     * look for hits in (infinity for no limit).
+     * @return true if the ray hit anything closer than hit.mT
+     */
+    virtual bool closestHit(const Scene &scene, const Ray &incoming, object::Hit &hit, Stats *stats = NULL) const = 0;
+
+    /**
+     * @brief Checks if anything blocks a ray before time tMax. Stops at
+     * the first hit found, which isn't necessarily the closest, so it's
+     * cheaper than closestHit(). Meant for shadow rays and other
+     * visibility tests.
+     *
+     * @param scene Scene the primitive references point into
+     */
+    virtual bool occluded(const Scene &scene, const Ray &incoming, double tMax, Stats *stats = NULL) const = 0;
+
+    /**
+     * @brief closestHit() for a packet of rays at once, up to
+     * sMaxPacketSize of them. Structures that can trace coherent rays
+     * (e.g. camera rays through neighbouring pixels) together override
+     * this, by default every ray is traced on its own.
+     *
+     * @param hits One per ray, each hits[i].mT set like closestHit()
+     * @return Bit mask of the rays that hit anything
+     */
+    virtual uint32_t closestHitPacket(const Scene &scene, const Ray *rays, object::Hit *hits, int count, Stats *stats = NULL) const;
+
+    /**
+     * @brief Checks if a ray hits anything. Returns the collision type
+     * of the closest primitive hit, and fills in the bounced ray, time,
+     * and color of that collision. Only the closest hit gets shaded.
+     *
+     * @param scene Scene the primitive references point into
+     */
+    object::Primitive::Collision intersects(const Scene &scene, const Ray &incoming, Ray &outgoing, double &t, Color &color, Stats *stats = NULL) const;
+
+    /**
+     * @brief Merge a thread's traversal counters into the totals.
+     * Thread safe.
+     */
+    void addStats(const Stats &stats);
+
+    /**
+     * @brief Average cost per ray of all traversals recorded with
+     * addStats(), using the same cost model as
+     * BoundingVolumeHierarchy::expectedCost().
+     */
+    double measuredCost();
+
+private:
+    Stats mStats;
+    std::mutex mStatsLock;
+};
@@ -4,43 +4,25 @@
 #include <cmath>
 #include <limits>
 
-BoundingBox::BoundingBox()
-{
-    for (int i = 0; i < 3; i++)
-    {
-        for (int j = 0; j < 2; j++)
-        {
-            mIntersections[i][j] = 0;
-        }
-    }
-}
+BoundingBox::BoundingBox() {}
 
 BoundingBox::BoundingBox(double minX, double maxX, double minY, double maxY, double minZ, double maxZ)
 {
-    mIntersections[V_X][0] = minX - sPadding;
-    mIntersections[V_X][1] = maxX + sPadding;
-    mIntersections[V_Y][0] = minY - sPadding;
-    mIntersections[V_Y][1] = maxY + sPadding;
-    mIntersections[V_Z][0] = minZ - sPadding;
-    mIntersections[V_Z][1] = maxZ + sPadding;
+    mMin = Vector(minX - sPadding, minY - sPadding, minZ - sPadding);
+    mMax = Vector(maxX + sPadding, maxY + sPadding, maxZ + sPadding);
 }
 
 bool BoundingBox::intersectsBox(const Ray &r, double &t)
 {
-    double minMaxInt = std::numeric_limits<double>::infinity();
-    double maxMinInt = -std::numeric_limits<double>::infinity();
-
-    // Find the intersection time range for each axis and track the
-    // max of the minInts and min of the maxInts.
-    for (int i = 0; i < 3; i++)
-    {
-        double int0 = intersectionTime(r, mIntersections[i][0], i);
-        double int1 = intersectionTime(r, mIntersections[i][1], i);
-        double thisMinInt = MIN(int0, int1);
-        double thisMaxInt = MAX(int0, int1);
-        maxMinInt = thisMinInt > maxMinInt ? thisMinInt : maxMinInt;
-        minMaxInt = thisMaxInt < minMaxInt ? thisMaxInt : minMaxInt;
-    }
+    // Find the intersection time range for each axis (solve P = O + td
+    // for t) and track the max of the minInts and min of the maxInts.
+    Vector invDir(1.0 / r.mDir[V_X], 1.0 / r.mDir[V_Y], 1.0 / r.mDir[V_Z]);
+    Vector int0 = Vector::svsub(mMin, r.mOrigin).vmul(invDir);
+    Vector int1 = Vector::svsub(mMax, r.mOrigin).vmul(invDir);
+    Vector minInts = Vector().vmin(int0, int1);
+    Vector maxInts = Vector().vmax(int0, int1);
+    double maxMinInt = MAX(MAX(minInts[V_X], minInts[V_Y]), minInts[V_Z]);
+    double minMaxInt = MIN(MIN(maxInts[V_X], maxInts[V_Y]), maxInts[V_Z]);
 
     // Check if the ranges overlap, also ignore boxes that are *fully*
     // behind the ray
@@ -53,46 +35,41 @@ bool BoundingBox::intersectsBox(const Ray &r, double &t)
     return false;
 }
 
-double BoundingBox::intersectionTime(const Ray &r, double val, int axis)
+int BoundingBox::largestAxis() const
 {
-    // Solve P = O + td for t
-    return (val - r.mOrigin[axis]) / r.mDir[axis];
+    Vector size = Vector::svsub(mMax, mMin);
+    if (size[V_X] > size[V_Y] && size[V_X] > size[V_Z])
+    {
+        return V_X;
+    }
+    if (size[V_Y] > size[V_Z])
+    {
+        return V_Y;
+    }
+    return V_Z;
 }
 
-BoundingBox &BoundingBox::merge(const BoundingBox &other)
+double BoundingBox::surfaceArea() const
 {
-    for (int i = 0; i < 3; i++)
+    Vector size = Vector::svsub(mMax, mMin);
+    if (size[V_X] < 0 || size[V_Y] < 0 || size[V_Z] < 0)
     {
-        // Make as large a box as needed to hold both boxes
-        if (mIntersections[i][0] > other.mIntersections[i][0])
-        {
-            mIntersections[i][0] = other.mIntersections[i][0];
-        }
-        if (mIntersections[i][1] < other.mIntersections[i][1])
-        {
-            mIntersections[i][1] = other.mIntersections[i][1];
-        }
+        // Empty box
+        return 0;
     }
-    return *this;
+    return 2.0 * (size[V_X] * size[V_Y] + size[V_Y] * size[V_Z] + size[V_Z] * size[V_X]);
 }
 
-int BoundingBox::largestAxis()
+BoundingBox BoundingBox::empty()
 {
-    double x = mIntersections[V_X][1] - mIntersections[V_X][0];
-    double y = mIntersections[V_Y][1] - mIntersections[V_Y][0];
-    double z = mIntersections[V_Z][1] - mIntersections[V_Z][0];
-    if (x > y && x > z)
-    {
-        return V_X;
-    }
-    if (y > z)
-    {
-        return V_Y;
-    }
-    return V_Z;
+    BoundingBox box;
+    double inf = std::numeric_limits<double>::infinity();
+    box.mMin = Vector(inf, inf, inf);
+    box.mMax = Vector(-inf, -inf, -inf);
+    return box;
 }
 
 bool BoundingBox::compare(const BoundingBox &a, const BoundingBox &b, int axis)
 {
-    return a.mIntersections[axis][0] < b.mIntersections[axis][0];
+    return a.mMin[axis] < b.mMin[axis];
 }
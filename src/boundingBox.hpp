@@ -7,7 +7,8 @@ class BoundingBox
 public:
     static constexpr double sPadding = 0.001; // Padding between the object and bounding box
 
-    double mIntersections[3][2];
+    Vector mMin;
+    Vector mMax;
 
     BoundingBox();
     BoundingBox(double minX, double maxX, double minY, double maxY, double minZ, double maxZ);
@@ -23,23 +24,41 @@ public:
      * @brief Merges another bounding box into this one.
      * Returns a reference to this.
      */
-    BoundingBox &merge(const BoundingBox &other);
+    inline BoundingBox &merge(const BoundingBox &other)
+    {
+        // Make as large a box as needed to hold both boxes
+        mMin.vmin(other.mMin);
+        mMax.vmax(other.mMax);
+        return *this;
+    }
 
     /**
      * @brief Return the largest axis of this bounding box.
      */
-    int largestAxis();
+    int largestAxis() const;
 
     /**
-     * @brief Compare two bounding boxes along an axis. Return
-     * true if a's min is less than b's min. False otherwise.
+     * @brief Return the surface area of this bounding box.
      */
-    static bool compare(const BoundingBox &a, const BoundingBox &b, int axis);
+    double surfaceArea() const;
+
+    /**
+     * @brief Return the center of this bounding box along an axis.
+     */
+    inline double centroid(int axis) const
+    {
+        return (mMin[axis] + mMax[axis]) / 2.0;
+    }
 
-private:
     /**
-     * @brief Calculate time in which the ray intersects a
-     * particular point along a particular axis.
+     * @brief Return a box that contains nothing. Merging anything
+     * into it results in the other box.
      */
-    double intersectionTime(const Ray &r, double val, int axis);
-};
\ No newline at end of file
+    static BoundingBox empty();
+
+    /**
+     * @brief Compare two bounding boxes along an axis. Return
+     * true if a's min is less than b's min. False otherwise.
+     */
+    static bool compare(const BoundingBox &a, const BoundingBox &b, int axis);
+};
@@ -1,161 +1,582 @@
 #include "bvh.hpp"
 #include "color.hpp"
 #include "scene.hpp"
+#include "common.hpp"
 
 #include <algorithm>
-#include <typeinfo>
+#include <array>
+#include <limits>
+#include <stdexcept>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
 
 BoundingVolumeHierarchy::BoundingVolumeHierarchy()
 {
-    mPrimitive = NULL;
+    mFirst = 0;
+    mCount = 0;
     mLeft = NULL;
     mRight = NULL;
 }
 
-BoundingVolumeHierarchy::BoundingVolumeHierarchy(std::vector<std::unique_ptr<object::Primitive>> &primitives) : BoundingVolumeHierarchy(primitives, 0, primitives.size()) {}
-
-BoundingVolumeHierarchy::BoundingVolumeHierarchy(std::vector<std::unique_ptr<object::Primitive>> &primitives, size_t start, size_t end)
+/**
+ * @brief Work waiting to be done by the build threads: subtrees, and
+ * pieces of passes over big ranges.
+ */
+class BoundingVolumeHierarchy::BuildQueue
 {
-    // See ray tracing in one weekend, their implementation is pretty smart.
-    // Just modifying it so it fits how I have the rest of my system set up.
-    mPrimitive = NULL;
-    mLeft = NULL;
-    mRight = NULL;
+public:
+    std::mutex mLock;
+    std::condition_variable mChanged;
+    std::vector<std::function<void()>> mTasks;
+    size_t mUnfinished = 0; // Tasks queued or running
 
-    // Find the longest axis
-    mBbox = BoundingBox();
-    for (int i = start; i < end; i++)
+    void push(std::function<void()> task)
     {
-        mBbox.merge(primitives[i]->mBoundingBox);
+        std::lock_guard<std::mutex> lock(mLock);
+        mTasks.push_back(std::move(task));
+        mUnfinished++;
+        mChanged.notify_one();
     }
-    int axis = mBbox.largestAxis();
-    int range = end - start;
 
-    // Go down the tree, generating nodes and assigning bounding boxes.
-    // Skip the camera, it doesn't have a bounding box (it's still a Primitive
-    // for json reasons).
-    if (range == 1 && typeid(*primitives[start]) != typeid(object::Camera))
+    /**
+     * @brief Run tasks off the queue, newest first, until done() is true.
+     * done() is checked with mLock held.
+     */
+    void work(const std::function<bool()> &done)
+    {
+        std::unique_lock<std::mutex> lock(mLock);
+        while (true)
+        {
+            mChanged.wait(lock, [&]
+                          { return done() || !mTasks.empty(); });
+            if (done())
+            {
+                return;
+            }
+            std::function<void()> task = std::move(mTasks.back());
+            mTasks.pop_back();
+            lock.unlock();
+
+            task();
+
+            lock.lock();
+            mUnfinished--;
+            // Threads wait for different things, so wake all of them
+            mChanged.notify_all();
+        }
+    }
+
+    /**
+     * @brief Run body(0) to body(count - 1) on any of the build threads,
+     * this one included, and return once they've all finished.
+     */
+    void parallelFor(size_t count, const std::function<void(size_t)> &body)
+    {
+        size_t remaining = count - 1; // Guarded by mLock
+        for (size_t i = 1; i < count; i++)
+        {
+            push([&, i]
+                 {
+                     body(i);
+                     std::lock_guard<std::mutex> lock(mLock);
+                     remaining--; });
+        }
+        body(0);
+        // Helps out with whatever is queued while waiting, so no thread
+        // sits idle waiting for the others
+        work([&]
+             { return remaining == 0; });
+    }
+};
+
+BoundingVolumeHierarchy::BoundingVolumeHierarchy(std::vector<BuildPrimitive> &primitives, enum SplitMethod method, int jobs) : BoundingVolumeHierarchy()
+{
+    init(primitives, method, jobs);
+}
+
+BoundingVolumeHierarchy::BoundingVolumeHierarchy(std::vector<BuildPrimitive> &primitives, size_t start, size_t end, enum SplitMethod method) : BoundingVolumeHierarchy()
+{
+    std::vector<BuildPrimitive> range(std::begin(primitives) + start, std::begin(primitives) + end);
+    init(range, method, 1);
+    std::copy(std::begin(range), std::end(range), std::begin(primitives) + start);
+}
+
+void BoundingVolumeHierarchy::init(std::vector<BuildPrimitive> &primitives, enum SplitMethod method, int jobs)
+{
+    if (primitives.size() > 1)
     {
-        mPrimitive = primitives[start].get();
-        mBbox = mPrimitive->mBoundingBox;
+        mNodes.reset(new BoundingVolumeHierarchy[2 * primitives.size() - 2]);
     }
-    else if (range == 2)
+    if (jobs <= 1 || primitives.size() < sParallelBuildMin)
     {
-        if (typeid(*primitives[start]) != typeid(object::Camera))
+        build(primitives, 0, primitives.size(), method, mNodes.get(), NULL);
+    }
+    else
+    {
+        // Every thread, this one included, takes work off the queue until
+        // nothing is queued or running. Each task only touches its own
+        // range of primitives.
+        BuildQueue queue;
+        queue.push([&]
+                   { build(primitives, 0, primitives.size(), method, mNodes.get(), &queue); });
+        auto worker = [&]
         {
-            mLeft = new BoundingVolumeHierarchy();
-            mLeft->mPrimitive = primitives[start].get();
-            mLeft->mBbox = mLeft->mPrimitive->mBoundingBox;
+            queue.work([&]
+                       { return queue.mUnfinished == 0; });
+        };
+        std::vector<std::thread> threads;
+        for (int i = 1; i < jobs; i++)
+        {
+            threads.emplace_back(worker);
         }
-        if (typeid(*primitives[start + 1]) != typeid(object::Camera))
+        worker();
+        for (std::thread &thread : threads)
         {
-            mRight = new BoundingVolumeHierarchy();
-            mRight->mPrimitive = primitives[start + 1].get();
-            mRight->mBbox = mRight->mPrimitive->mBoundingBox;
+            thread.join();
         }
     }
-    else
+
+    // Building leaves every leaf's primitives next to each other
+    mPrimitives.reserve(primitives.size());
+    for (const BuildPrimitive &primitive : primitives)
     {
-        // Recurse into each half of the BVH, split by object number along
-        // the longest axis.
+        mPrimitives.push_back(primitive.mRef);
+    }
+}
 
-        // Can't pass args to std::sort callback, so we're doing this
-        auto comparator = (axis == V_X)   ? BoundingVolumeHierarchy::compare_x
-                          : (axis == V_Y) ? BoundingVolumeHierarchy::compare_y
-                                          : BoundingVolumeHierarchy::compare_z;
+size_t BoundingVolumeHierarchy::chunkCount(size_t start, size_t end)
+{
+    return (end - start + sPassChunkSize - 1) / sPassChunkSize;
+}
 
-        std::sort(std::begin(primitives) + start, std::begin(primitives) + end, comparator);
-        mLeft = new BoundingVolumeHierarchy(primitives, start, start + range / 2);
-        mRight = new BoundingVolumeHierarchy(primitives, start + range / 2, end);
+void BoundingVolumeHierarchy::forEachChunk(size_t start, size_t end, BuildQueue *queue,
+                                           const std::function<void(size_t, size_t, size_t)> &pass)
+{
+    size_t chunks = chunkCount(start, end);
+    auto body = [&](size_t chunk)
+    {
+        pass(chunk, start + chunk * sPassChunkSize, MIN(end, start + (chunk + 1) * sPassChunkSize));
+    };
+    if (queue && chunks > 1)
+    {
+        queue->parallelFor(chunks, body);
+        return;
+    }
+    for (size_t chunk = 0; chunk < chunks; chunk++)
+    {
+        body(chunk);
     }
 }
 
-BoundingVolumeHierarchy::~BoundingVolumeHierarchy()
+template <typename Predicate>
+size_t BoundingVolumeHierarchy::partitionChunks(std::vector<BuildPrimitive> &primitives, size_t start, size_t end,
+                                                BuildQueue *queue, Predicate goesLeft)
 {
-    destroySubtree(this);
+    // Partition each piece on its own
+    size_t chunks = chunkCount(start, end);
+    std::vector<size_t> leftEnds(chunks);
+    forEachChunk(start, end, queue, [&](size_t chunk, size_t first, size_t last)
+                 { leftEnds[chunk] = std::partition(std::begin(primitives) + first, std::begin(primitives) + last, goesLeft) -
+                                     std::begin(primitives); });
+    size_t split = start;
+    for (size_t chunk = 0; chunk < chunks; chunk++)
+    {
+        split += leftEnds[chunk] - (start + chunk * sPassChunkSize);
+    }
+
+    // Then the pieces' right halves that landed left of the split trade
+    // places with their left halves that landed right of it. There are
+    // as many of one as of the other, and each is a run of primitives.
+    struct Run
+    {
+        size_t mStart, mEnd;
+    };
+    std::vector<Run> wrongRight, wrongLeft;
+    for (size_t chunk = 0; chunk < chunks; chunk++)
+    {
+        size_t first = start + chunk * sPassChunkSize;
+        size_t last = MIN(end, first + sPassChunkSize);
+        if (leftEnds[chunk] < split)
+        {
+            wrongRight.push_back({leftEnds[chunk], MIN(last, split)});
+        }
+        if (leftEnds[chunk] > split)
+        {
+            wrongLeft.push_back({MAX(first, split), leftEnds[chunk]});
+        }
+    }
+    struct Swap
+    {
+        size_t mLeft, mRight, mCount;
+    };
+    std::vector<Swap> swaps;
+    for (size_t r = 0, l = 0; r < wrongRight.size() && l < wrongLeft.size();)
+    {
+        size_t count = MIN(MIN(wrongRight[r].mEnd - wrongRight[r].mStart, wrongLeft[l].mEnd - wrongLeft[l].mStart), sPassChunkSize);
+        swaps.push_back({wrongRight[r].mStart, wrongLeft[l].mStart, count});
+        wrongRight[r].mStart += count;
+        wrongLeft[l].mStart += count;
+        r += wrongRight[r].mStart == wrongRight[r].mEnd;
+        l += wrongLeft[l].mStart == wrongLeft[l].mEnd;
+    }
+    auto swap = [&](size_t i)
+    {
+        std::swap_ranges(std::begin(primitives) + swaps[i].mLeft, std::begin(primitives) + swaps[i].mLeft + swaps[i].mCount,
+                         std::begin(primitives) + swaps[i].mRight);
+    };
+    if (queue && swaps.size() > 1)
+    {
+        queue->parallelFor(swaps.size(), swap);
+    }
+    else
+    {
+        for (size_t i = 0; i < swaps.size(); i++)
+        {
+            swap(i);
+        }
+    }
+    return split;
 }
 
-object::Primitive::Collision BoundingVolumeHierarchy::intersects(const Ray &incoming, Ray &outgoing, double &t, Color &color)
+void BoundingVolumeHierarchy::build(std::vector<BuildPrimitive> &primitives, size_t start, size_t end, enum SplitMethod method,
+                                    BoundingVolumeHierarchy *nodes, BuildQueue *queue)
 {
-    // Traverse down any nodes that intersect the ray
-    // (regardless of what side of the tree they're on).
-    // If a leaf node is reached run the intersection test
-    // and record the results.
-    //
-    // As you traverse, ignore any nodes with a farther
-    // intersection than the one you already have. If you
-    // find one closer you have to go all the way down until
-    // you get a miss on the bounding volume or you reach
-    // a primitive.
+    // See ray tracing in one weekend, their implementation is pretty smart.
+    // Just modifying it so it fits how I have the rest of my system set up.
+
+    // Find the bounds of the primitives and of their centroids. Big
+    // ranges are split into pieces, and the pieces' bounds merged.
+    auto findBounds = [&](size_t first, size_t last, BoundingBox &bounds, BoundingBox &centroids)
+    {
+        for (size_t i = first; i < last; i++)
+        {
+            const BoundingBox &box = primitives[i].mBoundingBox;
+            bounds.merge(box);
+            if (method == SAH)
+            {
+                BoundingBox centroid;
+                centroid.mMin = centroid.mMax = Vector::svscale(Vector::svadd(box.mMin, box.mMax), 0.5);
+                centroids.merge(centroid);
+            }
+        }
+    };
+    mBbox = BoundingBox::empty();
+    BoundingBox centroids = BoundingBox::empty();
+    size_t chunks = chunkCount(start, end);
+    if (chunks == 1)
+    {
+        findBounds(start, end, mBbox, centroids);
+    }
+    else
+    {
+        std::vector<BoundingBox> chunkBounds(chunks, BoundingBox::empty());
+        std::vector<BoundingBox> chunkCentroids(chunks, BoundingBox::empty());
+        forEachChunk(start, end, queue, [&](size_t chunk, size_t first, size_t last)
+                     { findBounds(first, last, chunkBounds[chunk], chunkCentroids[chunk]); });
+        for (size_t chunk = 0; chunk < chunks; chunk++)
+        {
+            mBbox.merge(chunkBounds[chunk]);
+            centroids.merge(chunkCentroids[chunk]);
+        }
+    }
+
+    // Find the longest axis
+    int axis = mBbox.largestAxis();
+    size_t range = end - start;
+    mFirst = start;
+    mCount = range;
+
+    // Go down the tree, generating nodes and assigning bounding boxes.
+    if (range == 1)
+    {
+        return;
+    }
 
-    object::Primitive::Collision collision = object::Primitive::Collision::MISSED;
-    if (mPrimitive)
+    size_t split = start + 1;
+    if (method == SAH)
     {
-        // Reached a leaf
-        Ray thisIncoming = Ray(incoming);
-        double thisT = t;
-        Color thisColor = Color(color);
-        collision = mPrimitive->collide(thisIncoming, thisT, thisColor);
-        if (collision != object::Primitive::Collision::MISSED && thisT < t)
+        split = partitionSah(primitives, start, end, mBbox, centroids, range <= sMaxLeafSize, queue);
+        if (split == end)
         {
-            // We hit something closer than our current mark, so remember it
-            outgoing = Ray(thisIncoming);
-            t = thisT;
-            color = Color(thisColor);
-            return collision;
+            // Cheaper to test all of them than to split
+            return;
         }
-        return object::Primitive::Collision::MISSED;
+    }
+    else if (range > 2)
+    {
+        split = start;
+    }
+    if (split == start)
+    {
+        // Split by object number along the longest axis. Also the
+        // fallback when SAH can't separate the primitives (e.g.
+        // identical centroids).
+        split = partitionMedian(primitives, start, end, axis, mBbox, queue);
     }
 
-    double tLeft, tRight;
-    bool intLeft = mLeft->mBbox.intersectsBox(incoming, tLeft);
-    bool intRight = mRight->mBbox.intersectsBox(incoming, tRight);
+    // Depth first layout: the left child, its descendants, then the
+    // right child and its descendants
+    size_t leftNodes = 2 * (split - start) - 1;
+    mLeft = &nodes[0];
+    mRight = &nodes[leftNodes];
 
-    // TODO: ignore nodes that are closer than t
-    if (intLeft)
+    // Big right halves go to another thread, the left half is built
+    // here either way
+    if (queue && end - split >= sParallelBuildMin)
+    {
+        BoundingVolumeHierarchy *right = mRight;
+        queue->push([=, &primitives]
+                    { right->build(primitives, split, end, method, right + 1, queue); });
+    }
+    else
     {
-        collision = mLeft->intersects(incoming, outgoing, t, color);
+        mRight->build(primitives, split, end, method, mRight + 1, queue);
     }
-    if (intRight)
+    mLeft->build(primitives, start, split, method, mLeft + 1, queue);
+}
+
+size_t BoundingVolumeHierarchy::partitionMedian(std::vector<BuildPrimitive> &primitives, size_t start, size_t end, int axis,
+                                                const BoundingBox &bounds, BuildQueue *queue)
+{
+    // Can't pass args to the comparator, so we're doing this
+    auto comparator = (axis == V_X)   ? BoundingVolumeHierarchy::compare_x
+                      : (axis == V_Y) ? BoundingVolumeHierarchy::compare_y
+                                      : BoundingVolumeHierarchy::compare_z;
+
+    // Only the split point matters, not the order within each half, so
+    // a selection is enough. Linear instead of a full O(n log n) sort.
+    size_t split = start + (end - start) / 2;
+    size_t selectStart = start, selectEnd = end;
+
+    double min = bounds.mMin[axis];
+    double extent = bounds.mMax[axis] - min;
+    if (chunkCount(start, end) > 1 && extent > 0)
     {
-        Ray thisOutgoing = Ray();
-        double thisT = t;
-        Color thisColor = Color(color);
-        object::Primitive::Collision rightCollision = mRight->intersects(incoming, thisOutgoing, thisT, thisColor);
-        if (rightCollision != object::Primitive::Collision::MISSED && thisT < t)
+        // Too many for one thread to select from. Bin them by the value
+        // they're compared by, and move the bins before the median's bin
+        // to the left and the ones after it to the right. Then only the
+        // median's bin is left to select from.
+        auto bin = [=](const BuildPrimitive &p)
         {
-            outgoing = Ray(thisOutgoing);
-            t = thisT;
-            color = Color(thisColor);
-            collision = rightCollision;
+            return CLAMP((int)(sMedianBins * (p.mBoundingBox.mMin[axis] - min) / extent), 0, sMedianBins - 1);
+        };
+        std::vector<std::array<size_t, sMedianBins>> chunkCounts(chunkCount(start, end));
+        forEachChunk(start, end, queue, [&](size_t chunk, size_t first, size_t last)
+                     {
+                         chunkCounts[chunk].fill(0);
+                         for (size_t i = first; i < last; i++)
+                         {
+                             chunkCounts[chunk][bin(primitives[i])]++;
+                         } });
+        int medianBin = 0;
+        for (size_t before = start; medianBin < sMedianBins; medianBin++)
+        {
+            for (const std::array<size_t, sMedianBins> &counts : chunkCounts)
+            {
+                before += counts[medianBin];
+            }
+            if (before > split)
+            {
+                break;
+            }
         }
+
+        selectStart = partitionChunks(primitives, start, end, queue, [&](const BuildPrimitive &p)
+                                      { return bin(p) < medianBin; });
+        selectEnd = partitionChunks(primitives, selectStart, end, queue, [&](const BuildPrimitive &p)
+                                    { return bin(p) == medianBin; });
+    }
+
+    std::nth_element(std::begin(primitives) + selectStart, std::begin(primitives) + split, std::begin(primitives) + selectEnd, comparator);
+    return split;
+}
+
+enum BoundingVolumeHierarchy::SplitMethod BoundingVolumeHierarchy::stringToSplitMethod(std::string str)
+{
+    if (str == "median")
+    {
+        return MEDIAN;
+    }
+    if (str == "sah")
+    {
+        return SAH;
+    }
+    throw std::invalid_argument("Invalid BVH split method");
+}
+
+double BoundingVolumeHierarchy::expectedCost() const
+{
+    if (isLeaf())
+    {
+        return mCount * sIntersectionCost;
     }
-    return collision;
+
+    // Probability of hitting a child given we hit this node is the ratio
+    // of their surface areas
+    double cost = sTraversalCost;
+    double area = mBbox.surfaceArea();
+    cost += mLeft->mBbox.surfaceArea() / area * mLeft->expectedCost();
+    cost += mRight->mBbox.surfaceArea() / area * mRight->expectedCost();
+    return cost;
 }
 
-void BoundingVolumeHierarchy::destroySubtree(BoundingVolumeHierarchy *subtree)
+size_t BoundingVolumeHierarchy::partitionSah(std::vector<BuildPrimitive> &primitives, size_t start, size_t end,
+                                             const BoundingBox &bounds, const BoundingBox &centroids, bool allowLeaf, BuildQueue *queue)
 {
-    if (subtree->mLeft)
+    // Bin primitives by their centroids, then sweep the bin boundaries
+    // on each axis to find the split with the lowest cost:
+    // C = C_trav + C_isect * (A_left * N_left + A_right * N_right) / A
+    // A is the same for every candidate, so compare without it.
+    double mins[3], extents[3];
+    for (int axis = 0; axis < 3; axis++)
+    {
+        mins[axis] = centroids.mMin[axis];
+        extents[axis] = centroids.mMax[axis] - mins[axis];
+    }
+    auto bin = [&](const BuildPrimitive &p, int axis)
+    {
+        return CLAMP((int)(sSahBins * (p.mBoundingBox.centroid(axis) - mins[axis]) / extents[axis]), 0, sSahBins - 1);
+    };
+
+    struct Bins
+    {
+        size_t mCounts[3][sSahBins];
+        BoundingBox mBoxes[3][sSahBins];
+    };
+    auto fillBins = [&](size_t first, size_t last, Bins &bins)
+    {
+        for (int axis = 0; axis < 3; axis++)
+        {
+            for (int b = 0; b < sSahBins; b++)
+            {
+                bins.mCounts[axis][b] = 0;
+                bins.mBoxes[axis][b] = BoundingBox::empty();
+            }
+            if (extents[axis] <= 0)
+            {
+                continue;
+            }
+            for (size_t i = first; i < last; i++)
+            {
+                int b = bin(primitives[i], axis);
+                bins.mCounts[axis][b]++;
+                bins.mBoxes[axis][b].merge(primitives[i].mBoundingBox);
+            }
+        }
+    };
+    Bins bins;
+    size_t chunks = chunkCount(start, end);
+    if (chunks == 1)
+    {
+        fillBins(start, end, bins);
+    }
+    else
+    {
+        // Each piece of the range is binned on its own, then the pieces
+        // are added up. Merging boxes doesn't depend on the order.
+        std::vector<Bins> chunkBins(chunks);
+        forEachChunk(start, end, queue, [&](size_t chunk, size_t first, size_t last)
+                     { fillBins(first, last, chunkBins[chunk]); });
+        fillBins(start, start, bins); // Empty, to add the pieces to
+        for (const Bins &piece : chunkBins)
+        {
+            for (int axis = 0; axis < 3; axis++)
+            {
+                for (int b = 0; b < sSahBins; b++)
+                {
+                    bins.mCounts[axis][b] += piece.mCounts[axis][b];
+                    bins.mBoxes[axis][b].merge(piece.mBoxes[axis][b]);
+                }
+            }
+        }
+    }
+
+    double bestCost = std::numeric_limits<double>::infinity();
+    int bestAxis = -1;
+    int bestBin = 0;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        if (extents[axis] <= 0)
+        {
+            continue;
+        }
+        const size_t *counts = bins.mCounts[axis];
+        const BoundingBox *boxes = bins.mBoxes[axis];
+
+        // Sweep right to left to get the area/count right of each boundary,
+        // then left to right to evaluate each split
+        double rightAreas[sSahBins];
+        size_t rightCounts[sSahBins];
+        BoundingBox right = BoundingBox::empty();
+        size_t rightCount = 0;
+        for (int b = sSahBins - 1; b > 0; b--)
+        {
+            right.merge(boxes[b]);
+            rightCount += counts[b];
+            rightAreas[b] = right.surfaceArea();
+            rightCounts[b] = rightCount;
+        }
+        BoundingBox left = BoundingBox::empty();
+        size_t leftCount = 0;
+        for (int b = 1; b < sSahBins; b++)
+        {
+            left.merge(boxes[b - 1]);
+            leftCount += counts[b - 1];
+            if (leftCount == 0 || rightCounts[b] == 0)
+            {
+                continue;
+            }
+            double cost = left.surfaceArea() * leftCount + rightAreas[b] * rightCounts[b];
+            if (cost < bestCost)
+            {
+                bestCost = cost;
+                bestAxis = axis;
+                bestBin = b;
+            }
+        }
+    }
+
+    if (allowLeaf)
     {
-        destroySubtree(subtree->mLeft);
+        // A leaf costs C_isect * N, a split its full cost from above
+        double area = bounds.surfaceArea();
+        if (bestAxis < 0 || area <= 0 ||
+            sTraversalCost + sIntersectionCost * bestCost / area >= sIntersectionCost * (end - start))
+        {
+            return end;
+        }
     }
-    if (subtree->mRight)
+    if (bestAxis < 0)
     {
-        destroySubtree(subtree->mRight);
+        return start;
     }
+
+    auto goesLeft = [&](const BuildPrimitive &p)
+    {
+        return bin(p, bestAxis) < bestBin;
+    };
+    if (chunks > 1)
+    {
+        return partitionChunks(primitives, start, end, queue, goesLeft);
+    }
+    auto mid = std::partition(std::begin(primitives) + start, std::begin(primitives) + end, goesLeft);
+    return mid - std::begin(primitives);
 }
 
-bool BoundingVolumeHierarchy::compare_x(const std::unique_ptr<object::Primitive> &a, const std::unique_ptr<object::Primitive> &b)
+BoundingVolumeHierarchy::~BoundingVolumeHierarchy() {}
+
+bool BoundingVolumeHierarchy::compare_x(const BuildPrimitive &a, const BuildPrimitive &b)
 {
-    return BoundingBox::compare(a->mBoundingBox, b->mBoundingBox, V_X);
+    return BoundingBox::compare(a.mBoundingBox, b.mBoundingBox, V_X);
 }
 
-bool BoundingVolumeHierarchy::compare_y(const std::unique_ptr<object::Primitive> &a, const std::unique_ptr<object::Primitive> &b)
+bool BoundingVolumeHierarchy::compare_y(const BuildPrimitive &a, const BuildPrimitive &b)
 {
-    return BoundingBox::compare(a->mBoundingBox, b->mBoundingBox, V_Y);
+    return BoundingBox::compare(a.mBoundingBox, b.mBoundingBox, V_Y);
 }
 
-bool BoundingVolumeHierarchy::compare_z(const std::unique_ptr<object::Primitive> &a, const std::unique_ptr<object::Primitive> &b)
+bool BoundingVolumeHierarchy::compare_z(const BuildPrimitive &a, const BuildPrimitive &b)
 {
-    return BoundingBox::compare(a->mBoundingBox, b->mBoundingBox, V_Z);
+    return BoundingBox::compare(a.mBoundingBox, b.mBoundingBox, V_Z);
 }
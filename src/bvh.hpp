@@ -1,6 +1,9 @@
 #pragma once
 
 #include <vector>
+#include <string>
+#include <memory>
+#include <functional>
 #include "ray.hpp"
 #include "boundingBox.hpp"
 #include "scene.hpp"
@@ -9,33 +12,151 @@
 class BoundingVolumeHierarchy
 {
 public:
-    object::Primitive *mPrimitive;
+    enum SplitMethod
+    {
+        MEDIAN = 0, // Split at the median primitive along the longest axis
+        SAH,        // Binned surface area heuristic
+    };
+
+    // Cost model for the surface area heuristic, relative to each other
+    static constexpr double sTraversalCost = 1.0;    // Cost of visiting an interior node (two box tests)
+    static constexpr double sIntersectionCost = 2.0; // Cost of a primitive intersection test
+    static constexpr int sSahBins = 16;              // Number of bins per axis
+    static constexpr size_t sMaxLeafSize = 8;        // Most primitives the SAH builder puts in one leaf
+    static constexpr size_t sParallelBuildMin = 4096; // Smallest subtree handed to another build thread
+    static constexpr size_t sPassChunkSize = 32768;   // Primitives per piece when a pass over a node is split between threads
+    static constexpr int sMedianBins = 1024;          // Bins narrowing down the median of big nodes
+
+    // What the builder sorts: a primitive's bounds and where to find it
+    struct BuildPrimitive
+    {
+        BoundingBox mBoundingBox;
+        object::PrimitiveRef mRef;
+    };
+
+    // Primitives in leaf order, filled in on the root only. Every node's
+    // primitives are the range [mFirst, mFirst + mCount) of it.
+    std::vector<object::PrimitiveRef> mPrimitives;
+    size_t mFirst;
+    size_t mCount;
     BoundingBox mBbox;
 
     BoundingVolumeHierarchy();
-    BoundingVolumeHierarchy(std::vector<std::unique_ptr<object::Primitive>> &primitives);
-    BoundingVolumeHierarchy(std::vector<std::unique_ptr<object::Primitive>> &primitives, size_t start, size_t end);
-    ~BoundingVolumeHierarchy();
 
     /**
-     * @brief Checks if a ray hits a bounding volume. If so,
-     * return the Primitive it contains, otherwise NULL.
-     *
-     * If the BVH is traversed successfully this should return the
-     * primitive that was hit.
+     * @brief Build a tree over primitives, reordering them.
      *
-     * If any level of the BVH results in misses for both the
-     * left and right child the method returns NULL.
+     * @param method MEDIAN splits down to one primitive per leaf. SAH
+     * stops where a leaf (of up to sMaxLeafSize primitives) costs no
+     * more than the best split, by the cost model above.
+     * @param jobs Number of threads to build with. Big subtrees are
+     * queued up and built by whichever thread is free, and the passes
+     * over big nodes near the root are split into pieces for all of
+     * them. The tree doesn't depend on the job count.
      */
-    object::Primitive::Collision intersects(const Ray &incoming, Ray &outgoing, double &t, Color &color);
+    BoundingVolumeHierarchy(std::vector<BuildPrimitive> &primitives, enum SplitMethod method = MEDIAN, int jobs = 1);
+    BoundingVolumeHierarchy(std::vector<BuildPrimitive> &primitives, size_t start, size_t end, enum SplitMethod method = MEDIAN);
+    ~BoundingVolumeHierarchy();
+
+    /**
+     * @brief Convert a string ("median", "sah") to a split method.
+     */
+    static enum SplitMethod stringToSplitMethod(std::string str);
+
+    /**
+     * @brief Expected cost of tracing a ray through this tree
+     * according to the SAH cost model, given that the ray hits
+     * this node's bounding box.
+     */
+    double expectedCost() const;
+
+    /**
+     * @brief Leaves hold mCount primitives, interior nodes have both children.
+     */
+    inline bool isLeaf() const
+    {
+        return mLeft == NULL;
+    }
 
 private:
+    friend class FlatBoundingVolumeHierarchy;
+
     BoundingVolumeHierarchy *mLeft;
     BoundingVolumeHierarchy *mRight;
 
-    void destroySubtree(BoundingVolumeHierarchy *subtree);
+    // Every node under the root, allocated in one block and freed with
+    // the root. A tree over n primitives has at most 2n - 1 nodes, so the
+    // size is known before building. Empty everywhere but the root.
+    std::unique_ptr<BoundingVolumeHierarchy[]> mNodes;
+
+    class BuildQueue;
+
+    /**
+     * @brief Build the tree over all of primitives.
+     */
+    void init(std::vector<BuildPrimitive> &primitives, enum SplitMethod method, int jobs);
+
+    /**
+     * @brief Turn this node into the tree for primitives[start, end).
+     *
+     * @param nodes Where this node's descendants go, up to
+     * 2 * (end - start) - 2 of them. Each subtree gets its own slice, so
+     * threads never share one and the layout doesn't depend on the job
+     * count.
+     * @param queue Where to hand off big subtrees and pieces of passes
+     * when building with several threads, NULL to build everything here
+     */
+    void build(std::vector<BuildPrimitive> &primitives, size_t start, size_t end, enum SplitMethod method,
+               BoundingVolumeHierarchy *nodes, BuildQueue *queue);
+
+    /**
+     * @brief Number of sPassChunkSize pieces primitives[start, end) is
+     * split into.
+     */
+    static size_t chunkCount(size_t start, size_t end);
+
+    /**
+     * @brief Run pass(chunk, first, last) over each piece
+     * primitives[first, last) of primitives[start, end), on all the build
+     * threads if there's a queue. The pieces don't depend on the job
+     * count, so results combined piece by piece don't either.
+     */
+    static void forEachChunk(size_t start, size_t end, BuildQueue *queue,
+                             const std::function<void(size_t, size_t, size_t)> &pass);
+
+    /**
+     * @brief Partition primitives[start, end) like std::partition, a
+     * piece per thread. Returns the index of the first primitive for
+     * which goesLeft is false.
+     */
+    template <typename Predicate>
+    static size_t partitionChunks(std::vector<BuildPrimitive> &primitives, size_t start, size_t end,
+                                  BuildQueue *queue, Predicate goesLeft);
+
+    /**
+     * @brief Find the best SAH split of primitives[start, end) and
+     * partition the range around it. Returns the index of the first
+     * primitive in the right half, or start if no split was found.
+     *
+     * @param bounds, centroids Bounds of the primitives, and of their
+     * centroids
+     * @param allowLeaf Return end instead, leaving the range as it is,
+     * if one leaf costs no more than the best split (or there isn't one)
+     */
+    static size_t partitionSah(std::vector<BuildPrimitive> &primitives, size_t start, size_t end,
+                               const BoundingBox &bounds, const BoundingBox &centroids, bool allowLeaf, BuildQueue *queue);
+
+    /**
+     * @brief Partition primitives[start, end) around the median on an
+     * axis, ordered like compare_x/y/z. Returns the index of the first
+     * primitive in the right half.
+     *
+     * @param bounds Bounds of the primitives
+     */
+    static size_t partitionMedian(std::vector<BuildPrimitive> &primitives, size_t start, size_t end, int axis,
+                                  const BoundingBox &bounds, BuildQueue *queue);
 
-    static bool compare_x(const std::unique_ptr<object::Primitive> &a, const std::unique_ptr<object::Primitive> &b);
-    static bool compare_y(const std::unique_ptr<object::Primitive> &a, const std::unique_ptr<object::Primitive> &b);
-    static bool compare_z(const std::unique_ptr<object::Primitive> &a, const std::unique_ptr<object::Primitive> &b);
+    static bool compare_x(const BuildPrimitive &a, const BuildPrimitive &b);
+    static bool compare_y(const BuildPrimitive &a, const BuildPrimitive &b);
+    static bool compare_z(const BuildPrimitive &a, const BuildPrimitive &b);
 };
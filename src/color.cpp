@@ -8,20 +8,6 @@ const std::map<std::string, enum Color::Surface> Color::sSurfaceMap = {
     {"emissive", Color::EMISSIVE},
 };
 
-Color::Color(Vector &vec)
-{
-    v[0] = vec[0];
-    v[1] = vec[1];
-    v[2] = vec[2];
-}
-
-Color::Color(Vector vec)
-{
-    v[0] = vec[0];
-    v[1] = vec[1];
-    v[2] = vec[2];
-}
-
 enum Color::Surface Color::stringToSurface(std::string str)
 {
     auto val = sSurfaceMap.find(str);
@@ -45,11 +31,6 @@ int Color::colorToInt(Color c)
     return (((uint8_t)(c[0] * 256)) << 16) | (((uint8_t)(c[1] * 256)) << 8) | ((uint8_t)(c[2] * 256));
 }
 
-Color Color::attenuate(Color surface, Color incoming)
-{
-    return Color(surface[0] * incoming[0], surface[1] * incoming[1], surface[2] * incoming[2]);
-}
-
 Color Color::refract(Color surface, Color incoming)
 {
     // TODO this is hard
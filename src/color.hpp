@@ -12,8 +12,8 @@ public:
     using Vector::Vector;
 
     // Explicit conversion constructor, since it's a downcast
-    Color(Vector &vec);
-    Color(Vector vec);
+    inline Color(Vector &vec) : Vector(vec) {}
+    inline Color(Vector vec) : Vector(vec) {}
 
     enum Surface
     {
@@ -49,7 +49,10 @@ public:
      * @param incoming
      * @return Color
      */
-    static Color attenuate(Color surface, Color incoming);
+    static inline Color attenuate(const Color &surface, const Color &incoming)
+    {
+        return Vector::svmul(surface, incoming);
+    }
 
     /**
      * @brief Send a colored ray through a dielectric (glass,
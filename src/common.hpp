@@ -2,9 +2,13 @@
 
 #include <cmath>
 #include <cstdlib>
-#include <random>
+#include "random.hpp"
 
+#ifdef VECTOR_FLOAT
+#define EPSILON (1e-4) // Float vectors can't resolve 1e-8, rays would hit the surface they just left
+#else
 #define EPSILON (1e-8)
+#endif
 #define CLOSE_TO(a, b) (std::abs(a - b) <= EPSILON)
 
 // In range, inclusive
@@ -28,8 +32,7 @@
        __typeof__ (upper) _upper = (upper); \
      (MIN(MAX(_val, _lower), _upper)); }))
 
-extern thread_local std::mt19937 randGen;                      // Defined in render.cpp
-extern thread_local std::uniform_real_distribution<> randDist; // Uniform [-1.0, 1.0) distribution, defined in render.cpp
+extern thread_local Pcg32 randGen; // Defined in render.cpp, seeded per path by Render
 
 /**
  * @brief Returns a random double in range [0, 1)
@@ -38,5 +41,5 @@ extern thread_local std::uniform_real_distribution<> randDist; // Uniform [-1.0,
  */
 static inline double randomDouble()
 {
-  return (randDist(randGen) + 1.0) / 2.0;
+  return randGen.nextDouble();
 }
\ No newline at end of file
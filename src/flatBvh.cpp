@@ -0,0 +1,156 @@
+#include "flatBvh.hpp"
+#include "common.hpp"
+
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+/**
+ * @brief Round a double to the nearest float in the given direction,
+ * so float bounds always contain the original double bounds.
+ */
+static float roundToFloat(double val, float direction)
+{
+    float f = (float)val;
+    if ((direction < 0 && f > val) || (direction > 0 && f < val))
+    {
+        f = std::nextafter(f, direction);
+    }
+    return f;
+}
+
+FlatBoundingVolumeHierarchy::FlatBoundingVolumeHierarchy() {}
+
+FlatBoundingVolumeHierarchy::FlatBoundingVolumeHierarchy(const BoundingVolumeHierarchy &bvh, int maxLeafSize)
+{
+    // Leaves are flattened left to right, so their primitives stay in
+    // the tree's order
+    mPrimitives = bvh.mPrimitives;
+    flatten(&bvh, 0, maxLeafSize);
+}
+
+void FlatBoundingVolumeHierarchy::refit(const std::vector<BoundingBox> &bounds)
+{
+    // Children always come after their parent, so going backwards
+    // finishes both children before their parent
+    for (size_t index = mNodes.size(); index-- > 0;)
+    {
+        Node &node = mNodes[index];
+        if (node.mCount > 0)
+        {
+            BoundingBox box = BoundingBox::empty();
+            for (uint32_t i = node.mOffset; i < node.mOffset + node.mCount; i++)
+            {
+                box.merge(bounds[mPrimitives[i].mIndex]);
+            }
+            for (int i = 0; i < 3; i++)
+            {
+                node.mMin[i] = roundToFloat(box.mMin[i], -std::numeric_limits<float>::infinity());
+                node.mMax[i] = roundToFloat(box.mMax[i], std::numeric_limits<float>::infinity());
+            }
+            continue;
+        }
+        const Node &left = mNodes[index + 1];
+        const Node &right = mNodes[node.mOffset];
+        for (int i = 0; i < 3; i++)
+        {
+            node.mMin[i] = std::fmin(left.mMin[i], right.mMin[i]);
+            node.mMax[i] = std::fmax(left.mMax[i], right.mMax[i]);
+        }
+    }
+}
+
+uint32_t FlatBoundingVolumeHierarchy::flatten(const BoundingVolumeHierarchy *node, int depth, int maxLeafSize)
+{
+    if (depth >= sStackSize)
+    {
+        throw std::length_error("BVH too deep to flatten");
+    }
+
+    uint32_t index = mNodes.size();
+    mNodes.emplace_back();
+    for (int i = 0; i < 3; i++)
+    {
+        mNodes[index].mMin[i] = roundToFloat(node->mBbox.mMin[i], -std::numeric_limits<float>::infinity());
+        mNodes[index].mMax[i] = roundToFloat(node->mBbox.mMax[i], std::numeric_limits<float>::infinity());
+    }
+    mNodes[index].mAxis = node->mBbox.largestAxis();
+
+    if (node->isLeaf() || node->mCount <= (size_t)maxLeafSize)
+    {
+        mNodes[index].mOffset = node->mFirst;
+        mNodes[index].mCount = node->mCount;
+        return index;
+    }
+
+    // Left child goes directly after this node, right child after the
+    // whole left subtree. mNodes may reallocate, so don't hold references.
+    flatten(node->mLeft, depth + 1, maxLeafSize);
+    uint32_t right = flatten(node->mRight, depth + 1, maxLeafSize);
+    mNodes[index].mOffset = right;
+    mNodes[index].mCount = 0;
+    return index;
+}
+
+bool FlatBoundingVolumeHierarchy::closestHit(const Scene &scene, const Ray &incoming, object::Hit &hit, Stats *stats) const
+{
+    // Visit every node whose box the ray hits, nearest first,
+    // and keep the closest primitive hit. Only the small Hit record
+    // gets copied around, the ray isn't touched until shading.
+    object::Hit thisHit;
+    auto leafTest = [&](uint32_t first, uint32_t count, double &closestT)
+    {
+        bool found = false;
+        for (uint32_t i = first; i < first + count; i++)
+        {
+            thisHit.mT = closestT;
+            if (scene.intersect(mPrimitives[i], incoming, thisHit) && thisHit.mT < closestT)
+            {
+                // We hit something closer than our current mark, so remember it
+                hit = thisHit;
+                closestT = thisHit.mT;
+                found = true;
+            }
+        }
+        return found;
+    };
+    double t = hit.mT;
+    return traverse(incoming, t, leafTest, stats);
+}
+
+bool FlatBoundingVolumeHierarchy::occluded(const Scene &scene, const Ray &incoming, double tMax, Stats *stats) const
+{
+    object::Hit hit;
+    auto leafTest = [&](uint32_t first, uint32_t count, double &t)
+    {
+        for (uint32_t i = first; i < first + count; i++)
+        {
+            hit.mT = t;
+            if (scene.intersect(mPrimitives[i], incoming, hit) && hit.mT < t)
+            {
+                return true;
+            }
+        }
+        return false;
+    };
+    return traverse<true>(incoming, tMax, leafTest, stats);
+}
+
+bool FlatBoundingVolumeHierarchy::intersectsNode(const Node &node, const Ray &r, double tMax, double &tEntry)
+{
+    double minMaxInt = std::numeric_limits<double>::infinity();
+    double maxMinInt = -std::numeric_limits<double>::infinity();
+
+    for (int i = 0; i < 3; i++)
+    {
+        double int0 = (node.mMin[i] - r.mOrigin[i]) / r.mDir[i];
+        double int1 = (node.mMax[i] - r.mOrigin[i]) / r.mDir[i];
+        double thisMinInt = MIN(int0, int1);
+        double thisMaxInt = MAX(int0, int1);
+        maxMinInt = thisMinInt > maxMinInt ? thisMinInt : maxMinInt;
+        minMaxInt = thisMaxInt < minMaxInt ? thisMaxInt : minMaxInt;
+    }
+
+    tEntry = maxMinInt;
+    return maxMinInt < minMaxInt && minMaxInt > 0 && maxMinInt <= tMax;
+}
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "ray.hpp"
+#include "bvh.hpp"
+#include "scene.hpp"
+#include "accelerationStructure.hpp"
+
+/**
+ * @brief Compact, linear-memory version of a BoundingVolumeHierarchy.
+ *
+ * Nodes are stored depth-first in one array. The left child of an
+ * interior node always directly follows it, the right child is
+ * referenced by index. Primitive references are stored in leaf order
+ * so a leaf is just a range in mPrimitives.
+ */
+class FlatBoundingVolumeHierarchy : public AccelerationStructure
+{
+public:
+    static constexpr int sStackSize = 64; // Max tree depth supported by traversal
+
+    struct Node
+    {
+        // Bounds are stored as floats to keep nodes at 32 bytes. They're
+        // rounded outwards so the box never shrinks.
+        float mMin[3];
+        float mMax[3];
+        uint32_t mOffset; // Leaf: index of the first primitive. Interior: index of the right child
+        uint16_t mCount;  // Number of primitives in a leaf, 0 for interior nodes
+        uint16_t mAxis;   // Axis the node was split on
+    };
+    static_assert(sizeof(Node) == 32, "BVH nodes should be 32 bytes");
+
+    std::vector<Node> mNodes;
+    std::vector<object::PrimitiveRef> mPrimitives;
+
+    FlatBoundingVolumeHierarchy();
+
+    /**
+     * @brief Flatten a tree.
+     *
+     * @param maxLeafSize Subtrees with this many primitives or fewer
+     * become one leaf, so a leaf test can check a batch of primitives
+     * at once. Leaves of the tree stay leaves whatever their size.
+     */
+    FlatBoundingVolumeHierarchy(const BoundingVolumeHierarchy &bvh, int maxLeafSize = 1);
+
+    /**
+     * @brief Recompute every node's bounds for primitives that moved,
+     * keeping the tree as it is. Cheaper than building a new tree, and
+     * just as good if the primitives only moved rigidly.
+     *
+     * @param bounds New bounds of each primitive, indexed by
+     * PrimitiveRef::mIndex
+     */
+    void refit(const std::vector<BoundingBox> &bounds);
+
+    bool closestHit(const Scene &scene, const Ray &incoming, object::Hit &hit, Stats *stats = NULL) const override;
+    bool occluded(const Scene &scene, const Ray &incoming, double tMax, Stats *stats = NULL) const override;
+
+    /**
+     * @brief Walk every leaf the ray reaches and let the caller test
+     * the primitives in it. leafTest(first, count, t) is called with the
+     * leaf's range in mPrimitives and the closest time found so far. It
+     * should return true and update t if it found a closer hit.
+     *
+     * Children are visited front to back, and nodes the ray enters
+     * after time t are skipped, so a close hit culls the rest of the
+     * tree. With AnyHit, traversal stops at the first leafTest hit.
+     *
+     * Returns true if any call to leafTest returned true.
+     */
+    template <bool AnyHit = false, typename LeafTest>
+    bool traverse(const Ray &r, double &t, LeafTest leafTest, Stats *stats = NULL) const
+    {
+        double tBox;
+        if (mNodes.empty() || !intersectsNode(mNodes[0], r, t, tBox))
+        {
+            return false;
+        }
+        if (stats)
+        {
+            stats->mRays++;
+        }
+
+        // Nodes still to visit, with the time the ray enters them
+        bool hit = false;
+        uint32_t stack[sStackSize];
+        double stackT[sStackSize];
+        int stackSize = 0;
+        uint32_t index = 0;
+        while (true)
+        {
+            const Node &node = mNodes[index];
+            if (node.mCount > 0)
+            {
+                // Reached a leaf
+                if (stats)
+                {
+                    stats->mPrimitives += node.mCount;
+                }
+                if (leafTest(node.mOffset, node.mCount, t))
+                {
+                    hit = true;
+                    if (AnyHit)
+                    {
+                        return true;
+                    }
+                }
+            }
+            else
+            {
+                if (stats)
+                {
+                    stats->mNodes++;
+                }
+                double tLeft, tRight;
+                bool intLeft = intersectsNode(mNodes[index + 1], r, t, tLeft);
+                bool intRight = intersectsNode(mNodes[node.mOffset], r, t, tRight);
+                if (intLeft && intRight)
+                {
+                    // Closer child first, a hit in it may cull the other one
+                    if (tRight < tLeft)
+                    {
+                        stack[stackSize] = index + 1;
+                        stackT[stackSize++] = tLeft;
+                        index = node.mOffset;
+                    }
+                    else
+                    {
+                        stack[stackSize] = node.mOffset;
+                        stackT[stackSize++] = tRight;
+                        index = index + 1;
+                    }
+                    continue;
+                }
+                if (intLeft)
+                {
+                    index = index + 1;
+                    continue;
+                }
+                if (intRight)
+                {
+                    index = node.mOffset;
+                    continue;
+                }
+            }
+
+            // Pop the next node, skipping any the ray only reaches
+            // after a hit found since it was pushed
+            do
+            {
+                if (stackSize == 0)
+                {
+                    return hit;
+                }
+                stackSize--;
+            } while (stackT[stackSize] > t);
+            index = stack[stackSize];
+        }
+    }
+
+private:
+    /**
+     * @brief Append a subtree to mNodes depth-first. Returns the
+     * index of the subtree's root node.
+     */
+    uint32_t flatten(const BoundingVolumeHierarchy *node, int depth, int maxLeafSize);
+
+    /**
+     * @brief Slab test against a node's bounds. Same semantics as
+     * BoundingBox::intersectsBox(), except boxes the ray enters after
+     * tMax are a miss.
+     *
+     * @param tEntry Time the ray enters the box, negative if it starts inside
+     */
+    static bool intersectsNode(const Node &node, const Ray &r, double tMax, double &tEntry);
+};
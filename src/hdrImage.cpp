@@ -0,0 +1,179 @@
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+#include "hdrImage.hpp"
+#include "common.hpp"
+
+HdrImage::HdrImage() : mWidth(0), mHeight(0) {}
+
+HdrImage::HdrImage(int width, int height) : mWidth(width), mHeight(height), mPixels(width * height * 3, 0.0f) {}
+
+enum HdrImage::ToneMap HdrImage::stringToToneMap(std::string str)
+{
+    static const std::map<std::string, enum ToneMap> toneMaps = {
+        {"clamp", CLAMP},
+        {"reinhard", REINHARD},
+        {"aces", ACES},
+    };
+    auto it = toneMaps.find(str);
+    if (it == toneMaps.end())
+    {
+        throw std::invalid_argument("Invalid tone map " + str);
+    }
+    return it->second;
+}
+
+float *HdrImage::getPixel(int y, int x)
+{
+    if (y < 0 || y >= mHeight || x < 0 || x >= mWidth)
+    {
+        throw std::invalid_argument("Invalid coordinate value");
+    }
+    return &mPixels[(y * mWidth + x) * 3];
+}
+
+void HdrImage::toneMap(enum ToneMap toneMap, uint8_t *out) const
+{
+    for (size_t i = 0; i < mPixels.size(); i++)
+    {
+        double c = MAX(mPixels[i], 0.0f);
+        switch (toneMap)
+        {
+        case CLAMP:
+            break;
+        case REINHARD:
+            c = c / (1.0 + c);
+            break;
+        case ACES:
+            c = (c * (2.51 * c + 0.03)) / (c * (2.43 * c + 0.59) + 0.14);
+            break;
+        }
+        out[i] = (uint8_t)(MIN(c, 1.0) * 255);
+    }
+}
+
+/**
+ * @brief Append a value to a buffer as little-endian bytes,
+ * regardless of the host's byte order.
+ */
+template <typename T>
+static void appendLe(std::string &buf, T val)
+{
+    static const uint16_t one = 1;
+    static const bool littleEndian = *(const uint8_t *)&one == 1;
+
+    uint8_t bytes[sizeof(T)];
+    std::memcpy(bytes, &val, sizeof(T));
+    for (size_t i = 0; i < sizeof(T); i++)
+    {
+        buf.push_back((char)(littleEndian ? bytes[i] : bytes[sizeof(T) - 1 - i]));
+    }
+}
+
+void HdrImage::writePfm(std::string filename) const
+{
+    // Negative scale means little-endian. Rows go bottom to top.
+    std::string buf = "PF\n" + std::to_string(mWidth) + " " + std::to_string(mHeight) + "\n-1.0\n";
+    buf.reserve(buf.size() + mPixels.size() * sizeof(float));
+    for (int y = mHeight - 1; y >= 0; y--)
+    {
+        for (int x = 0; x < mWidth * 3; x++)
+        {
+            appendLe(buf, mPixels[y * mWidth * 3 + x]);
+        }
+    }
+
+    std::ofstream out(filename, std::ios::out | std::ios::binary);
+    out.write(buf.data(), buf.size());
+    out.close();
+}
+
+/**
+ * @brief Append an OpenEXR header attribute.
+ */
+static void appendExrAttribute(std::string &buf, const std::string &name, const std::string &type, const std::string &value)
+{
+    buf += name;
+    buf.push_back('\0');
+    buf += type;
+    buf.push_back('\0');
+    appendLe(buf, (int32_t)value.size());
+    buf += value;
+}
+
+void HdrImage::writeExr(std::string filename) const
+{
+    static const int32_t exrFloat = 2; // Pixel type of 32 bit float channels
+    std::string buf;
+
+    // Magic number, then version 2 with no flags set (single part scanline)
+    appendLe(buf, (int32_t)20000630);
+    appendLe(buf, (int32_t)2);
+
+    // Channels have to be in alphabetical order
+    std::string channels;
+    for (const char *name : {"B", "G", "R"})
+    {
+        channels += name;
+        channels.push_back('\0');
+        appendLe(channels, exrFloat);
+        appendLe(channels, (int32_t)0); // pLinear + 3 reserved bytes
+        appendLe(channels, (int32_t)1); // x sampling
+        appendLe(channels, (int32_t)1); // y sampling
+    }
+    channels.push_back('\0');
+    appendExrAttribute(buf, "channels", "chlist", channels);
+
+    appendExrAttribute(buf, "compression", "compression", std::string(1, '\0')); // NO_COMPRESSION
+
+    std::string window;
+    appendLe(window, (int32_t)0);
+    appendLe(window, (int32_t)0);
+    appendLe(window, (int32_t)(mWidth - 1));
+    appendLe(window, (int32_t)(mHeight - 1));
+    appendExrAttribute(buf, "dataWindow", "box2i", window);
+    appendExrAttribute(buf, "displayWindow", "box2i", window);
+
+    appendExrAttribute(buf, "lineOrder", "lineOrder", std::string(1, '\0')); // INCREASING_Y
+
+    std::string one;
+    appendLe(one, 1.0f);
+    appendExrAttribute(buf, "pixelAspectRatio", "float", one);
+
+    std::string center;
+    appendLe(center, 0.0f);
+    appendLe(center, 0.0f);
+    appendExrAttribute(buf, "screenWindowCenter", "v2f", center);
+    appendExrAttribute(buf, "screenWindowWidth", "float", one);
+    buf.push_back('\0'); // End of header
+
+    // Offset table. Uncompressed files have one scanline per chunk.
+    const uint64_t chunkSize = 2 * sizeof(int32_t) + mWidth * 3 * sizeof(float);
+    const uint64_t firstChunk = buf.size() + mHeight * sizeof(uint64_t);
+    for (int y = 0; y < mHeight; y++)
+    {
+        appendLe(buf, (uint64_t)(firstChunk + y * chunkSize));
+    }
+
+    // Each chunk is the y coordinate, data size, then each channel's
+    // row of pixels one after the other
+    buf.reserve(firstChunk + mHeight * chunkSize);
+    for (int y = 0; y < mHeight; y++)
+    {
+        appendLe(buf, (int32_t)y);
+        appendLe(buf, (int32_t)(mWidth * 3 * sizeof(float)));
+        for (int c = 2; c >= 0; c--)
+        {
+            for (int x = 0; x < mWidth; x++)
+            {
+                appendLe(buf, mPixels[(y * mWidth + x) * 3 + c]);
+            }
+        }
+    }
+
+    std::ofstream out(filename, std::ios::out | std::ios::binary);
+    out.write(buf.data(), buf.size());
+    out.close();
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Floating point RGB image, with writers for HDR file formats
+ * and tone mapping down to 24 bit color.
+ */
+class HdrImage
+{
+public:
+    enum ToneMap
+    {
+        CLAMP = 0, // Clip each channel to 1.0
+        REINHARD,  // c / (1 + c)
+        ACES,      // Narkowicz's fit of the ACES filmic curve
+    };
+
+    int mWidth, mHeight;
+    std::vector<float> mPixels; // RGB, top row first
+
+    HdrImage();
+    HdrImage(int width, int height);
+
+    /**
+     * @brief Convert a string (clamp, reinhard, aces) to a ToneMap.
+     * Throws std::invalid_argument for anything else.
+     */
+    static enum ToneMap stringToToneMap(std::string str);
+
+    /**
+     * @brief Get a pointer to the RGB values of a pixel.
+     */
+    float *getPixel(int y, int x);
+
+    /**
+     * @brief Tone map the image into a 24 bit RGB buffer of the same size.
+     */
+    void toneMap(enum ToneMap toneMap, uint8_t *out) const;
+
+    /**
+     * @brief Write the image as a little-endian color PFM file.
+     */
+    void writePfm(std::string filename) const;
+
+    /**
+     * @brief Write the image as an uncompressed, single part, scanline
+     * OpenEXR file with 32 bit float R, G, and B channels.
+     */
+    void writeExr(std::string filename) const;
+};
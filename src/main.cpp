@@ -1,27 +1,93 @@
 #include <iostream>
 #include <unistd.h>
+#include <getopt.h>
 #include <string>
 #include <ctime>
 #include <cstdlib>
 #include "render.hpp"
 #include "scene.hpp"
 #include "bvh.hpp"
+#include "flatBvh.hpp"
+#include "wideBvh.hpp"
+#include "mesh.hpp"
+#include "hdrImage.hpp"
+#include "sceneCache.hpp"
+#include "sampler.hpp"
 
-#define HELP                                                                      \
-    "COMS 336 Ray Tracing Renderer\n"                                             \
-    "usage: render.exe [options]\n\n"                                             \
-    "options:\n"                                                                  \
-    "-h                 Show this help message and exit\n"                        \
-    "-s [SCENE_JSON]    Scene file for the renderer.\n"                           \
-    "                       Default: scenes/sample.json\n"                        \
-    "-r [RESOLUTION]    Resolution for the renderer, in the form\n"               \
-    "                       [width]x[height]. Default: 1024x768\n"                \
-    "-a [AA_LEVEL]      Anti-aliasing level (number of rays per pixel).\n"        \
-    "                       Default: 1\n"                                         \
-    "-d [DEPTH]         Max ray depth (number of bounces). Default: 50\n"         \
-    "-j [JOBS]          Job count. Default: 1\n"                                  \
-    "-o [OUTPUT]        Output file path. Outputs [OUTPUT].ppm (packed binary)\n" \
-    "                       and [OUTPUT].txt.ppm (text). Default: render\n"
+#define HELP                                                                       \
+    "COMS 336 Ray Tracing Renderer\n"                                              \
+    "usage: render.exe [options]\n\n"                                              \
+    "options:\n"                                                                   \
+    "-h                 Show this help message and exit\n"                         \
+    "-s [SCENE_JSON]    Scene file for the renderer.\n"                            \
+    "                       Default: scenes/sample.json\n"                         \
+    "-r [RESOLUTION]    Resolution for the renderer, in the form\n"                \
+    "                       [width]x[height]. Default: 1024x768\n"                 \
+    "-a [AA_LEVEL]      Anti-aliasing level (number of rays per pixel).\n"         \
+    "                       Default: 1\n"                                          \
+    "-d [DEPTH]         Max ray depth (number of bounces). Default: 50\n"          \
+    "-j [JOBS]          Job count. Default: 1\n"                                   \
+    "-t [TILE_SIZE]     Width/height of the square tiles handed out to\n"          \
+    "                       each job. Default: 32\n"                               \
+    "-o [OUTPUT]        Output file path. Outputs [OUTPUT].ppm (packed binary),\n" \
+    "                       [OUTPUT].txt.ppm (text), and the unclamped HDR\n"      \
+    "                       image as [OUTPUT].pfm and [OUTPUT].exr.\n"             \
+    "                       Default: render\n"                                     \
+    "-T [TONE_MAP]      How the HDR image is mapped to the .ppm outputs:\n"        \
+    "                       clamp, reinhard or aces. Default: clamp\n"             \
+    "-k                 Also save [OUTPUT].samples, the raw sample sums, for\n"    \
+    "                       the merge tool to add up with other renders\n"         \
+    "-b [BUILDER]       BVH split method, median or sah. Default: median\n"        \
+    "-W [WIDTH]         BVH width, 2, 4 or 8 children per node. Wide BVHs test\n"  \
+    "                       all of a node's children at once with SIMD.\n"         \
+    "                       Default: 2\n"                                          \
+    "-P [SIZE]          Trace camera rays in packets of SIZE (4, 8 or 16)\n"       \
+    "                       neighbouring pixels, through the BVH together.\n"      \
+    "                       1 traces every ray on its own. Default: 1\n"           \
+    "--wavefront        Trace paths in batches, one stage (hits, shading,\n"       \
+    "                       shadow rays) at a time for the whole batch,\n"         \
+    "                       instead of one path at a time\n"                       \
+    "-M [MEGABYTES]     Memory for baking mesh instances into world space.\n"      \
+    "                       Models are baked in scene order until their\n"         \
+    "                       copies would go over the budget, the rest move\n"      \
+    "                       rays into object space instead. Default: 0\n"          \
+    "--no-cache         Don't read or write [SCENE].cache, the parsed scene\n"     \
+    "                       and BVH saved to skip loading next time\n"             \
+    "-p [INTERVAL]      Render progressively, one sample per pixel per pass,\n"    \
+    "                       and write the image so far to\n"                       \
+    "                       [OUTPUT].snapshot.ppm every INTERVAL passes, or\n"     \
+    "                       every INTERVAL seconds with an s suffix (e.g. 30s).\n" \
+    "                       0 renders progressively without snapshots.\n"          \
+    "-e [THRESHOLD]     Adaptive sampling. Stop sampling a pixel once the 95%\n"   \
+    "                       confidence interval of its brightness is within\n"     \
+    "                       +/- THRESHOLD (1.0 is white), using AA_LEVEL as\n"     \
+    "                       the max samples per pixel. Also outputs\n"             \
+    "                       [OUTPUT].spp.ppm, a heatmap of samples per pixel.\n"   \
+    "-m [MIN_SAMPLES]   Samples per pixel before adaptive sampling checks\n"       \
+    "                       for convergence. Default: 8\n"                         \
+    "-R [DEPTH]         Bounces before Russian roulette starts ending dim\n"       \
+    "                       paths early. Default: 3\n"                             \
+    "-S [SEED]          Random seed. Renders with the same seed and settings\n"    \
+    "                       are identical. Default: random\n"                      \
+    "--sampler [NAME]   Where the pixel, lens and diffuse bounce samples\n"        \
+    "                       come from: random, sobol (Owen scrambled Sobol,\n"     \
+    "                       per pixel) or bluenoise (one Sobol sequence,\n"        \
+    "                       offset by blue noise). The Sobol samplers work\n"      \
+    "                       best with power of two AA_LEVELs.\n"                   \
+    "                       Default: random\n"                                     \
+    "-c [SECONDS]       Checkpoint the render to [OUTPUT].checkpoint between\n"    \
+    "                       passes, at most every SECONDS seconds. Renders one\n"  \
+    "                       sample per pixel per pass, like -p.\n"                 \
+    "--resume           Continue the render in [OUTPUT].checkpoint. Use the\n"     \
+    "                       same options as the render that wrote it.\n"           \
+    "-L [PORT]          Coordinate a distributed render: listen on PORT and\n"     \
+    "                       hand tiles out to workers instead of rendering\n"      \
+    "                       locally. Not compatible with -e.\n"                    \
+    "-w [HOST:PORT]     Work for the coordinator at HOST:PORT with JOBS\n"         \
+    "                       threads. Use the same scene, resolution, tile\n"       \
+    "                       size and render options as the coordinator.\n"         \
+    "-n                 Disable next event estimation (sampling lights\n"          \
+    "                       directly at every diffuse bounce)\n"
 
 int main(int argc, char *argv[])
 {
@@ -31,8 +97,37 @@ int main(int argc, char *argv[])
     int antiAliasingLevel = 1;
     int depth = 50;
     int jobs = 1;
+    int tileSize = 32;
     std::string outputPath = "render";
-    while ((opt = getopt(argc, argv, "hs:r:a:d:j:o:")) != -1)
+    BoundingVolumeHierarchy::SplitMethod splitMethod = BoundingVolumeHierarchy::MEDIAN;
+    int bvhWidth = 2;
+    int packetSize = 1;
+    size_t bakeBudget = 0;
+    bool progressive = false;
+    int snapshotPasses = 0, snapshotSeconds = 0;
+    double adaptiveThreshold = 0;
+    int minSamples = 8;
+    bool nextEventEstimation = true;
+    int rouletteDepth = 3;
+    HdrImage::ToneMap toneMap = HdrImage::CLAMP;
+    bool seeded = false;
+    uint64_t seed = 0;
+    int checkpointSeconds = -1;
+    bool resume = false;
+    bool saveSamples = false;
+    bool useCache = true;
+    bool wavefront = false;
+    Sampler::Type samplerType = Sampler::RANDOM;
+    int coordinatorPort = -1;
+    std::string coordinatorAddress;
+    static const struct option longOptions[] = {
+        {"resume", no_argument, NULL, 'C'},
+        {"no-cache", no_argument, NULL, 'N'},
+        {"wavefront", no_argument, NULL, 'F'},
+        {"sampler", required_argument, NULL, 'Q'},
+        {NULL, 0, NULL, 0},
+    };
+    while ((opt = getopt_long(argc, argv, "hs:r:a:d:j:t:o:kT:b:W:P:M:p:e:m:nR:S:c:L:w:", longOptions, NULL)) != -1)
     {
         switch (opt)
         {
@@ -60,9 +155,81 @@ int main(int argc, char *argv[])
         case 'j':
             jobs = (int)std::stoul(optarg);
             break;
+        case 't':
+            tileSize = (int)std::stoul(optarg);
+            break;
         case 'o':
             outputPath = std::string(optarg);
             break;
+        case 'k':
+            saveSamples = true;
+            break;
+        case 'T':
+            toneMap = HdrImage::stringToToneMap(std::string(optarg));
+            break;
+        case 'b':
+            splitMethod = BoundingVolumeHierarchy::stringToSplitMethod(std::string(optarg));
+            break;
+        case 'W':
+            bvhWidth = (int)std::stoul(optarg);
+            break;
+        case 'P':
+            packetSize = (int)std::stoul(optarg);
+            break;
+        case 'M':
+            bakeBudget = std::stoull(optarg);
+            break;
+        case 'p':
+        {
+            std::string optargStr(optarg);
+            progressive = true;
+            if (!optargStr.empty() && optargStr.back() == 's')
+            {
+                snapshotSeconds = (int)std::stoul(optargStr.substr(0, optargStr.size() - 1));
+            }
+            else
+            {
+                snapshotPasses = (int)std::stoul(optargStr);
+            }
+            break;
+        }
+        case 'e':
+            adaptiveThreshold = std::stod(optarg);
+            break;
+        case 'm':
+            minSamples = (int)std::stoul(optarg);
+            break;
+        case 'n':
+            nextEventEstimation = false;
+            break;
+        case 'R':
+            rouletteDepth = (int)std::stoul(optarg);
+            break;
+        case 'S':
+            seeded = true;
+            seed = std::stoull(optarg);
+            break;
+        case 'c':
+            checkpointSeconds = (int)std::stoul(optarg);
+            break;
+        case 'C':
+            resume = true;
+            break;
+        case 'N':
+            useCache = false;
+            break;
+        case 'F':
+            wavefront = true;
+            break;
+        case 'Q':
+            samplerType = Sampler::stringToType(std::string(optarg));
+            break;
+        case 'L':
+            coordinatorPort = (int)std::stoul(optarg);
+            break;
+        case 'w':
+            coordinatorAddress = std::string(optarg);
+            break;
         default:
             return 1;
         }
@@ -71,20 +238,110 @@ int main(int argc, char *argv[])
     try
     {
         std::time_t startTime = std::time(NULL);
+        if (bvhWidth != 2 && bvhWidth != 4 && bvhWidth != 8)
+        {
+            throw std::invalid_argument("BVH width must be 2, 4, or 8");
+        }
 
+        // Cached textures point into the cache, so it has to outlive the scene
+        SceneCache cache(scenePath);
         Scene s;
-        std::cout << "Building scene..." << std::endl;
-        s.load(scenePath);
+        std::unique_ptr<FlatBoundingVolumeHierarchy> flatBvh;
+        double expectedCost;
+        if (useCache && cache.load(s, flatBvh, expectedCost, splitMethod))
+        {
+            std::cout << "Loaded scene and bounding volumes from " << scenePath << ".cache" << std::endl;
+        }
+        else
+        {
+            std::cout << "Building scene..." << std::endl;
+            s.load(scenePath, jobs);
 
-        std::cout << "Generating bounding volumes..." << std::endl;
-        BoundingVolumeHierarchy *bvh = new BoundingVolumeHierarchy(s.mPrimitives); // Must be heap alloc
+            std::cout << "Generating bounding volumes..." << std::endl;
+            std::vector<BoundingVolumeHierarchy::BuildPrimitive> primitives;
+            for (object::PrimitiveRef ref : s.primitives())
+            {
+                primitives.push_back({s.primitive(ref).mBoundingBox, ref});
+            }
+            BoundingVolumeHierarchy *bvh = new BoundingVolumeHierarchy(primitives, splitMethod, jobs); // Must be heap alloc
+            flatBvh = std::make_unique<FlatBoundingVolumeHierarchy>(*bvh);
+            expectedCost = bvh->expectedCost();
+            delete bvh;
+            s.reorder(flatBvh->mPrimitives);
+            if (useCache)
+            {
+                cache.save(s, *flatBvh, expectedCost, splitMethod);
+            }
+        }
+        std::cout << "BVH has " << flatBvh->mNodes.size() << " nodes." << std::endl;
+
+        // Wide BVHs are collapsed from the binary ones, which is cheap
+        // enough to redo every run instead of caching
+        std::unique_ptr<AccelerationStructure> wideBvh;
+        if (bvhWidth == 4)
+        {
+            wideBvh = std::make_unique<WideBoundingVolumeHierarchy<4>>(*flatBvh);
+        }
+        else if (bvhWidth == 8)
+        {
+            wideBvh = std::make_unique<WideBoundingVolumeHierarchy<8>>(*flatBvh);
+        }
+        if (bakeBudget > 0 && !s.mModels.empty())
+        {
+            size_t baked = s.bakeModels(bakeBudget << 20);
+            std::cout << "Baked " << baked << " of " << s.mModels.size() << " mesh instances into world space." << std::endl;
+        }
+        for (std::unique_ptr<Mesh> &mesh : s.mMeshes)
+        {
+            mesh->widen(bvhWidth);
+        }
+        for (std::unique_ptr<Mesh> &mesh : s.mBakedMeshes)
+        {
+            mesh->widen(bvhWidth);
+        }
+        AccelerationStructure &bvh = wideBvh ? *wideBvh : *flatBvh;
 
-        Render render(s, *bvh, width, height, antiAliasingLevel, jobs, depth);
+        Render render(s, bvh, width, height, antiAliasingLevel, jobs, depth, tileSize);
+        if (progressive)
+        {
+            render.setProgressive(outputPath + ".snapshot", snapshotPasses, snapshotSeconds, toneMap);
+        }
+        if (seeded)
+        {
+            render.setSeed(seed);
+        }
+        if (checkpointSeconds >= 0 || resume)
+        {
+            render.setCheckpoint(outputPath + ".checkpoint", MAX(checkpointSeconds, 0));
+        }
+        render.setNextEventEstimation(nextEventEstimation);
+        render.setRussianRoulette(rouletteDepth);
+        render.setPacketSize(packetSize);
+        render.setWavefront(wavefront);
+        render.setSampler(samplerType);
+        if (adaptiveThreshold > 0)
+        {
+            render.setAdaptive(adaptiveThreshold, minSamples);
+        }
+        if (resume)
+        {
+            render.resume(outputPath + ".checkpoint");
+        }
+        if (coordinatorPort >= 0)
+        {
+            render.setCoordinator(coordinatorPort);
+        }
+        if (!coordinatorAddress.empty())
+        {
+            render.runWorker(coordinatorAddress);
+            return 0;
+        }
         std::cout << "Launching renderer..." << std::endl;
         render.run();
+        std::cout << "BVH traversal cost per ray: expected " << expectedCost
+                  << ", measured " << bvh.measuredCost() << "." << std::endl;
         std::cout << "Saving output..." << std::endl;
-        render.save(outputPath);
-        delete bvh;
+        render.save(outputPath, toneMap, saveSamples);
 
         char timeElapsed[9];
         time_t interval = std::time(NULL) - startTime;
@@ -0,0 +1,121 @@
+#include "mesh.hpp"
+#include "common.hpp"
+
+#include <stdexcept>
+
+Mesh::Mesh() {}
+
+Mesh::Mesh(const tinyobj::ObjReader &obj, int jobs)
+{
+    auto &attrib = obj.GetAttrib();
+    auto &shapes = obj.GetShapes();
+    Vector texcoords[3] = {Vector(0, 0, 0), Vector(0, 0, 0), Vector(0, 0, 0)};
+    for (size_t s = 0; s < shapes.size(); s++)
+    {
+        const tinyobj::shape_t &shape = shapes[s];
+        size_t numTriangles = shape.mesh.num_face_vertices.size();
+        size_t indexOffset = 0;
+        for (size_t n = 0; n < numTriangles; n++)
+        {
+            // Every face is going to be 3 vertices (almost always)
+            Vector vertices[3];
+            for (int i = 0; i < 3; i++)
+            {
+                // Index buffer lookup
+                tinyobj::index_t index = shape.mesh.indices[indexOffset + i];
+                // Vertex buffer lookup
+                for (int j = 0; j < 3; j++)
+                {
+                    vertices[i][j] = attrib.vertices[3 * size_t(index.vertex_index) + j];
+                }
+            }
+            // Surface and color come from the Model at shading time
+            mTriangles.emplace_back(vertices, texcoords, Color::DIFFUSE, 0.0, Color(0, 0, 0));
+            indexOffset += 3;
+        }
+    }
+
+    if (mTriangles.size() == 0)
+    {
+        throw std::invalid_argument("OBJ file has no faces");
+    }
+
+    std::vector<BoundingVolumeHierarchy::BuildPrimitive> primitives;
+    for (size_t i = 0; i < mTriangles.size(); i++)
+    {
+        primitives.push_back({mTriangles[i].mBoundingBox, {object::TRIANGLE, (uint32_t)i}});
+    }
+    BoundingVolumeHierarchy *bvh = new BoundingVolumeHierarchy(primitives, BoundingVolumeHierarchy::SAH, jobs);
+    mBvh = std::make_unique<FlatBoundingVolumeHierarchy>(*bvh, TriangleBuffer::sBatchSize);
+    delete bvh;
+
+    // Put the triangles in leaf order
+    std::vector<object::Triangle> sorted;
+    sorted.reserve(mTriangles.size());
+    for (object::PrimitiveRef &ref : mBvh->mPrimitives)
+    {
+        sorted.push_back(mTriangles[ref.mIndex]);
+        ref.mIndex = sorted.size() - 1;
+    }
+    mTriangles = std::move(sorted);
+    mBuffer = TriangleBuffer(mTriangles);
+}
+
+Mesh::Mesh(const Mesh &mesh, const ModelMatrix &modelMatrix) : mBuffer(mesh.mTriangles, &modelMatrix)
+{
+    std::vector<BoundingBox> bounds;
+    bounds.reserve(mBuffer.size());
+    for (size_t i = 0; i < mBuffer.size(); i++)
+    {
+        bounds.push_back(mBuffer.boundingBox(i));
+    }
+    mBvh = std::make_unique<FlatBoundingVolumeHierarchy>();
+    mBvh->mNodes = mesh.mBvh->mNodes;
+    mBvh->mPrimitives = mesh.mBvh->mPrimitives;
+    mBvh->refit(bounds);
+}
+
+size_t Mesh::bakedSize() const
+{
+    return mBuffer.memoryUsage() +
+           mBvh->mNodes.size() * sizeof(FlatBoundingVolumeHierarchy::Node) +
+           mBvh->mPrimitives.size() * sizeof(object::PrimitiveRef);
+}
+
+bool Mesh::intersect(const Ray &incoming, object::Hit &hit) const
+{
+    if (mBvh8)
+    {
+        return intersect(*mBvh8, incoming, hit);
+    }
+    if (mBvh4)
+    {
+        return intersect(*mBvh4, incoming, hit);
+    }
+    return intersect(*mBvh, incoming, hit);
+}
+
+void Mesh::widen(int width)
+{
+    mBvh4.reset(width == 4 ? new WideBoundingVolumeHierarchy<4>(*mBvh) : NULL);
+    mBvh8.reset(width == 8 ? new WideBoundingVolumeHierarchy<8>(*mBvh) : NULL);
+}
+
+template <typename Bvh>
+bool Mesh::intersect(const Bvh &bvh, const Ray &incoming, object::Hit &hit) const
+{
+    double t = hit.mT;
+    WatertightRay ray(incoming);
+    auto leafTest = [&](uint32_t first, uint32_t count, double &closestT)
+    {
+        // Only triangles go in here, and they're in leaf order, so the
+        // leaf's range is also its range in mBuffer
+        return mBuffer.intersect(first, count, ray, closestT, closestT, hit.mU, hit.mV, hit.mTriangle);
+    };
+    if (!bvh.traverse(incoming, t, leafTest))
+    {
+        return false;
+    }
+    hit.mT = t;
+    return true;
+}
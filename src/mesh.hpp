@@ -0,0 +1,82 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include "tiny_obj_loader.h"
+#include "scene.hpp"
+#include "bvh.hpp"
+#include "flatBvh.hpp"
+#include "wideBvh.hpp"
+#include "triangleBuffer.hpp"
+
+/**
+ * @brief Triangle mesh loaded from an OBJ file, in object space.
+ *
+ * Built once per unique OBJ file and shared by every Model that
+ * instances it. The triangles get their own BVH (bottom level), the
+ * scene BVH only sees the Models (top level).
+ */
+class Mesh
+{
+public:
+    // Object space triangles, stored in BVH leaf order so each leaf
+    // reads a contiguous run of them
+    std::vector<object::Triangle> mTriangles;
+    TriangleBuffer mBuffer; // mTriangles again, in the layout intersect() tests
+    std::unique_ptr<FlatBoundingVolumeHierarchy> mBvh;
+
+    // Wide copy of mBvh used instead of it, if widen() was called
+    std::unique_ptr<WideBoundingVolumeHierarchy<4>> mBvh4;
+    std::unique_ptr<WideBoundingVolumeHierarchy<8>> mBvh8;
+
+    /**
+     * @brief Copy the faces out of an OBJ file and build their BVH.
+     * Meshes are always built with SAH, they have far more primitives
+     * than the scene BVH and the median split does badly on them.
+     * Leaves hold up to TriangleBuffer::sBatchSize triangles, which are
+     * tested together.
+     *
+     * @param jobs Number of threads to build the BVH with
+     */
+    Mesh(const tinyobj::ObjReader &obj, int jobs = 1);
+
+    /**
+     * @brief Empty mesh, for SceneCache to fill in.
+     */
+    Mesh();
+
+    /**
+     * @brief Bake one instance of a mesh: its triangles moved into world
+     * space with a model matrix, and its BVH refit to them. Only keeps
+     * mBuffer and the BVH, not mTriangles, so the Model shades hits with
+     * the original mesh's triangles.
+     */
+    Mesh(const Mesh &mesh, const ModelMatrix &modelMatrix);
+
+    /**
+     * @brief Bytes a baked copy of this mesh takes, for the triangle
+     * buffer and the binary BVH.
+     */
+    size_t bakedSize() const;
+
+    /**
+     * @brief Find the closest triangle hit by an object space ray.
+     *
+     * @param incoming Ray in object space, direction not normalized
+     * @param hit Filled in with the time t, the index of the triangle
+     * in mTriangles, and the barycentric coordinates of the hit. Only
+     * hits closer than the starting hit.mT are looked for.
+     * @return true if the ray hit a triangle before hit.mT
+     */
+    bool intersect(const Ray &incoming, object::Hit &hit) const;
+
+    /**
+     * @brief Collapse mBvh into a 4 or 8 wide BVH and trace against
+     * that instead. Width 2 goes back to mBvh.
+     */
+    void widen(int width);
+
+private:
+    template <typename Bvh>
+    bool intersect(const Bvh &bvh, const Ray &incoming, object::Hit &hit) const;
+};
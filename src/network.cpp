@@ -0,0 +1,179 @@
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "network.hpp"
+
+static std::runtime_error socketError(const std::string &what)
+{
+    return std::runtime_error(what + ": " + std::strerror(errno));
+}
+
+Connection::Connection(int fd) : mFd(fd)
+{
+    // Messages are small request/response pairs, don't let Nagle hold them back
+    int one = 1;
+    setsockopt(mFd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+Connection::~Connection()
+{
+    ::close(mFd);
+}
+
+std::unique_ptr<Connection> Connection::connect(const std::string &address)
+{
+    size_t colon = address.rfind(':');
+    if (colon == std::string::npos)
+    {
+        throw std::invalid_argument("Address should be host:port");
+    }
+    std::string host = address.substr(0, colon);
+    std::string port = address.substr(colon + 1);
+
+    struct addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo *results;
+    int err = getaddrinfo(host.c_str(), port.c_str(), &hints, &results);
+    if (err != 0)
+    {
+        throw std::runtime_error("Can't resolve " + address + ": " + gai_strerror(err));
+    }
+
+    int fd = -1;
+    for (struct addrinfo *ai = results; ai; ai = ai->ai_next)
+    {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0)
+        {
+            continue;
+        }
+        if (::connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+        {
+            break;
+        }
+        ::close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(results);
+    if (fd < 0)
+    {
+        throw socketError("Can't connect to " + address);
+    }
+    return std::make_unique<Connection>(fd);
+}
+
+void Connection::send(const void *data, size_t size)
+{
+    const char *bytes = (const char *)data;
+    while (size > 0)
+    {
+        ssize_t sent = ::send(mFd, bytes, size, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (sent <= 0)
+        {
+            throw socketError("Send failed");
+        }
+        bytes += sent;
+        size -= sent;
+    }
+}
+
+void Connection::receive(void *data, size_t size)
+{
+    char *bytes = (char *)data;
+    while (size > 0)
+    {
+        ssize_t received = ::recv(mFd, bytes, size, 0);
+        if (received < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (received == 0)
+        {
+            throw std::runtime_error("Connection closed");
+        }
+        if (received < 0)
+        {
+            throw socketError("Receive failed");
+        }
+        bytes += received;
+        size -= received;
+    }
+}
+
+void Connection::sendBlob(const std::string &blob)
+{
+    sendValue((uint64_t)blob.size());
+    send(blob.data(), blob.size());
+}
+
+std::string Connection::receiveBlob()
+{
+    std::string blob(receiveValue<uint64_t>(), '\0');
+    receive(&blob[0], blob.size());
+    return blob;
+}
+
+Listener::Listener(int port)
+{
+    int fd = socket(AF_INET6, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        throw socketError("Can't create socket");
+    }
+    int one = 1, zero = 0;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero)); // Accept IPv4 too
+
+    struct sockaddr_in6 addr = {};
+    addr.sin6_family = AF_INET6;
+    addr.sin6_addr = in6addr_any;
+    addr.sin6_port = htons(port);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0)
+    {
+        ::close(fd);
+        throw socketError("Can't listen on port " + std::to_string(port));
+    }
+    mFd = fd;
+}
+
+Listener::~Listener()
+{
+    close();
+}
+
+std::unique_ptr<Connection> Listener::accept()
+{
+    while (true)
+    {
+        int fd = ::accept(mFd, NULL, NULL);
+        if (fd >= 0)
+        {
+            return std::make_unique<Connection>(fd);
+        }
+        if (errno != EINTR && errno != ECONNABORTED)
+        {
+            return NULL;
+        }
+    }
+}
+
+void Listener::close()
+{
+    int fd = mFd.exchange(-1);
+    if (fd >= 0)
+    {
+        // shutdown() wakes up accept() on Linux, close() alone doesn't
+        shutdown(fd, SHUT_RDWR);
+        ::close(fd);
+    }
+}
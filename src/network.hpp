@@ -0,0 +1,80 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+/**
+ * @brief Blocking TCP connection. Every send/receive either transfers
+ * the whole buffer or throws std::runtime_error, so callers can treat
+ * a dropped connection like any other exception.
+ */
+class Connection
+{
+public:
+    explicit Connection(int fd);
+    ~Connection();
+
+    Connection(const Connection &) = delete;
+    Connection &operator=(const Connection &) = delete;
+
+    /**
+     * @brief Connect to a listening socket.
+     *
+     * @param address host:port
+     */
+    static std::unique_ptr<Connection> connect(const std::string &address);
+
+    void send(const void *data, size_t size);
+    void receive(void *data, size_t size);
+
+    template <typename T>
+    void sendValue(T val)
+    {
+        send(&val, sizeof(T));
+    }
+    template <typename T>
+    T receiveValue()
+    {
+        T val;
+        receive(&val, sizeof(T));
+        return val;
+    }
+
+    /**
+     * @brief Send a length-prefixed string/blob.
+     */
+    void sendBlob(const std::string &blob);
+    std::string receiveBlob();
+
+private:
+    int mFd;
+};
+
+/**
+ * @brief TCP socket listening on all interfaces.
+ */
+class Listener
+{
+public:
+    explicit Listener(int port);
+    ~Listener();
+
+    Listener(const Listener &) = delete;
+    Listener &operator=(const Listener &) = delete;
+
+    /**
+     * @brief Wait for the next connection. Returns NULL once the
+     * listener has been closed.
+     */
+    std::unique_ptr<Connection> accept();
+
+    /**
+     * @brief Stop listening, waking up any thread blocked in accept().
+     */
+    void close();
+
+private:
+    std::atomic<int> mFd; // -1 once closed, accept() may be reading it from another thread
+};
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdint>
+
+/**
+ * @brief PCG32 random number generator (O'Neill, "PCG: A Family of
+ * Simple Fast Space-Efficient Statistically Good Algorithms for Random
+ * Number Generation", 2014): a 64 bit linear congruential generator
+ * with a permuted 32 bit output. 16 bytes of state, so it's cheap to
+ * reseed for every path, and two different seeds give unrelated
+ * sequences.
+ */
+class Pcg32
+{
+public:
+    inline Pcg32()
+    {
+        seed(0x853c49e6748fea9bULL, 0xda3e39cb94b95bdbULL);
+    }
+
+    inline Pcg32(uint64_t state, uint64_t sequence = 0)
+    {
+        seed(state, sequence);
+    }
+
+    /**
+     * @brief Restart the generator.
+     *
+     * @param state Starting point in the sequence
+     * @param sequence Which of the 2^63 sequences to use
+     */
+    inline void seed(uint64_t state, uint64_t sequence = 0)
+    {
+        mState = 0;
+        mIncrement = (sequence << 1) | 1;
+        next();
+        mState += state;
+        next();
+    }
+
+    /**
+     * @brief Uniform 32 bit integer.
+     */
+    inline uint32_t next()
+    {
+        uint64_t old = mState;
+        mState = old * 6364136223846793005ULL + mIncrement;
+        uint32_t shifted = (uint32_t)(((old >> 18) ^ old) >> 27);
+        uint32_t rotation = (uint32_t)(old >> 59);
+        return (shifted >> rotation) | (shifted << ((-rotation) & 31));
+    }
+
+    /**
+     * @brief Uniform double in [0, 1), with 32 random bits.
+     */
+    inline double nextDouble()
+    {
+        return next() * (1.0 / 4294967296.0);
+    }
+
+    /**
+     * @brief Mix the bits of a 64 bit value (the splitmix64 finalizer),
+     * to turn counters like pixel and sample indices into unrelated
+     * seeds.
+     */
+    static inline uint64_t hash(uint64_t x)
+    {
+        x ^= x >> 30;
+        x *= 0xbf58476d1ce4e5b9ULL;
+        x ^= x >> 27;
+        x *= 0x94d049bb133111ebULL;
+        x ^= x >> 31;
+        return x;
+    }
+
+private:
+    uint64_t mState;
+    uint64_t mIncrement;
+};
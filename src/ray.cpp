@@ -1,17 +0,0 @@
-#include "ray.hpp"
-#include "color.hpp"
-
-Ray::Ray() {}
-
-Ray::Ray(Vector origin, Vector dir)
-{
-    mOrigin = origin;
-    mDir = dir;
-    mColor = Color(1.0, 1.0, 1.0);
-    mIndexOfRefraction = 1.0; // Air
-}
-
-void Ray::addCollision(Color color)
-{
-    mColor = Color::attenuate(mColor, color);
-}
@@ -2,6 +2,11 @@
 #include "vector.hpp"
 #include "color.hpp"
 
+namespace object
+{
+    class Primitive;
+}
+
 class Ray
 {
 public:
@@ -12,8 +17,23 @@ public:
 
     double mIndexOfRefraction; // Index of refraction of the material we're currently in
 
-    Ray();
-    Ray(Vector origin, Vector dir);
+    // The surface the ray last bounced off of, filled in by Primitive::bounce().
+    // Used by the renderer for light sampling.
+    const object::Primitive *mBouncePrimitive;
+    enum Color::Surface mBounceSurface;
+    Vector mBounceNormal; // Normal the bounce was computed with, not necessarily facing the ray
+
+    // Uniform [0, 1)^2 numbers for picking the direction of a diffuse
+    // bounce, filled in by the renderer's Sampler before shading
+    double mScatterSample[2];
+
+    inline Ray() {}
+    inline Ray(const Vector &origin, const Vector &dir)
+        : mOrigin(origin), mDir(dir), mColor(1.0, 1.0, 1.0), mIndexOfRefraction(1.0), // Air
+          mBouncePrimitive(NULL), mBounceSurface(Color::SPECULAR) {}
 
-    void addCollision(Color color);
-};
\ No newline at end of file
+    inline void addCollision(const Color &color)
+    {
+        mColor.vmul(color);
+    }
+};
@@ -8,9 +8,16 @@
 #include <chrono>
 #include <ctime>
 #include <limits>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <sstream>
+#include <algorithm>
+#include <random>
 #include "render.hpp"
 #include "vector.hpp"
-#include "bvh.hpp"
+#include "accelerationStructure.hpp"
 #include "common.hpp"
 
 // Framebuffer indices
@@ -19,10 +26,9 @@
 #define B (2)
 
 // Defined in common.hpp
-thread_local std::mt19937 randGen;
-thread_local std::uniform_real_distribution<> randDist;
+thread_local Pcg32 randGen;
 
-Render::Render(Scene &scene, BoundingVolumeHierarchy &bvh, int width, int height, int antiAliasingLevel, int jobs, int maxBounces) : mScene(scene), mBvh(bvh)
+Render::Render(Scene &scene, AccelerationStructure &bvh, int width, int height, int antiAliasingLevel, int jobs, int maxBounces, int tileSize) : mScene(scene), mBvh(bvh), mSamples(width, height), mScheduler(width, height, tileSize, jobs)
 {
     mWidth = width;
     mHeight = height;
@@ -34,10 +40,32 @@ Render::Render(Scene &scene, BoundingVolumeHierarchy &bvh, int width, int height
     }
 
     mJobs = jobs;
-    mNextPixelX = mNextPixelY = 0;
+    mPixelsDone = 0;
+    mTilesDone = 0;
+    mPixelsSampled = 0;
     mKillThreads = false;
 
+    mPasses = 1;
+    mPassesDone = 0;
+    mSamplesPerPass = antiAliasingLevel;
+    mProgressive = false;
+    mSnapshotPassInterval = mSnapshotSecondsInterval = 0;
+    mSnapshotToneMap = HdrImage::CLAMP;
+    mSeed = ((uint64_t)std::random_device()() << 32) | std::random_device()();
+    mCheckpointSecondsInterval = 0;
+    mCoordinatorPort = -1;
+    mRemotePass = 0;
+    mRemoteDone = false;
+    mAdaptive = false;
+    mAdaptiveThreshold = 0;
+    mMinSamples = antiAliasingLevel;
+
     mMaxBounces = maxBounces;
+    mNextEventEstimation = true;
+    mRouletteDepth = 3;
+    mPacketSize = 1;
+    mWavefront = false;
+    mStats.mPathLengths.resize(maxBounces + 1);
 
     setupImgPlane();
     Vector focalLength = Vector::svscale(mScene.mCamera.mFront, mScene.mCamera.mFocalLength);
@@ -49,32 +77,465 @@ Render::~Render()
     free(mFb);
 }
 
+void Render::setProgressive(std::string snapshotPath, int passInterval, int secondsInterval, enum HdrImage::ToneMap toneMap)
+{
+    mProgressive = true;
+    mPasses = mAntiAliasingLevel;
+    mSamplesPerPass = 1;
+    mSnapshotPath = snapshotPath;
+    mSnapshotPassInterval = passInterval;
+    mSnapshotSecondsInterval = secondsInterval;
+    mSnapshotToneMap = toneMap;
+}
+
+void Render::setAdaptive(double threshold, int minSamples)
+{
+    if (threshold <= 0 || minSamples < 2)
+    {
+        throw std::invalid_argument("Adaptive sampling needs a positive threshold and at least 2 samples per pixel");
+    }
+    mAdaptive = true;
+    mAdaptiveThreshold = threshold;
+    mMinSamples = MIN(minSamples, mAntiAliasingLevel);
+}
+
+void Render::setNextEventEstimation(bool enabled)
+{
+    mNextEventEstimation = enabled;
+}
+
+void Render::setRussianRoulette(int minDepth)
+{
+    mRouletteDepth = minDepth;
+}
+
+void Render::setPacketSize(int size)
+{
+    if (size != 1 && size != 4 && size != 8 && size != 16)
+    {
+        throw std::invalid_argument("Packet size must be 1, 4, 8 or 16");
+    }
+    mPacketSize = size;
+}
+
+void Render::setWavefront(bool enabled)
+{
+    mWavefront = enabled;
+}
+
+void Render::setSampler(enum Sampler::Type type)
+{
+    mSampler = Sampler(type, mWidth);
+}
+
+void Render::setSeed(uint64_t seed)
+{
+    mSeed = seed;
+}
+
+void Render::setCheckpoint(std::string checkpointPath, int secondsInterval)
+{
+    mPasses = mAntiAliasingLevel;
+    mSamplesPerPass = 1;
+    mCheckpointPath = checkpointPath;
+    mCheckpointSecondsInterval = secondsInterval;
+}
+
+// Checkpoint file layout, in host byte order:
+//   magic, version
+//   width, height, antiAliasingLevel, passes, samplesPerPass, adaptive, passesDone, seed
+//   mSamples
+static const uint32_t sCheckpointMagic = 0x4b435452; // "RTCK"
+static const uint32_t sCheckpointVersion = 2;
+
+/**
+ * @brief Read or write one value of a checkpoint header.
+ */
+template <typename T>
+static void writeValue(std::ofstream &out, T val)
+{
+    out.write((const char *)&val, sizeof(T));
+}
+template <typename T>
+static T readValue(std::ifstream &in)
+{
+    T val;
+    in.read((char *)&val, sizeof(T));
+    return val;
+}
+
+void Render::checkpoint()
+{
+    std::string tmpPath = mCheckpointPath + ".tmp";
+    std::ofstream out(tmpPath, std::ios::out | std::ios::binary);
+    writeValue(out, sCheckpointMagic);
+    writeValue(out, sCheckpointVersion);
+    writeValue(out, (int32_t)mWidth);
+    writeValue(out, (int32_t)mHeight);
+    writeValue(out, (int32_t)mAntiAliasingLevel);
+    writeValue(out, (int32_t)mPasses);
+    writeValue(out, (int32_t)mSamplesPerPass);
+    writeValue(out, (int32_t)mAdaptive);
+    writeValue(out, (int32_t)mPassesDone);
+    writeValue(out, mSeed);
+    mSamples.write(out);
+    out.close();
+
+    if (!out || std::rename(tmpPath.c_str(), mCheckpointPath.c_str()) != 0)
+    {
+        std::cout << std::endl
+                  << "Failed to write checkpoint " << mCheckpointPath << ": " << std::strerror(errno) << std::endl;
+    }
+}
+
+void Render::resume(std::string checkpointPath)
+{
+    std::ifstream in(checkpointPath, std::ios::in | std::ios::binary);
+    if (!in)
+    {
+        throw std::invalid_argument("Can't open checkpoint " + checkpointPath);
+    }
+    if (readValue<uint32_t>(in) != sCheckpointMagic || readValue<uint32_t>(in) != sCheckpointVersion)
+    {
+        throw std::invalid_argument("Not a checkpoint file, or from a different version");
+    }
+    bool matches = readValue<int32_t>(in) == mWidth;
+    matches &= readValue<int32_t>(in) == mHeight;
+    matches &= readValue<int32_t>(in) == mAntiAliasingLevel;
+    matches &= readValue<int32_t>(in) == mPasses;
+    matches &= readValue<int32_t>(in) == mSamplesPerPass;
+    matches &= readValue<int32_t>(in) == (int32_t)mAdaptive;
+    if (!matches)
+    {
+        throw std::invalid_argument("Checkpoint was made with different render settings");
+    }
+    mPassesDone = readValue<int32_t>(in);
+    mSeed = readValue<uint64_t>(in);
+    SampleBuffer samples;
+    samples.read(in);
+    if (samples.mWidth != mWidth || samples.mHeight != mHeight)
+    {
+        throw std::invalid_argument("Checkpoint was made with different render settings");
+    }
+    mSamples = std::move(samples);
+}
+
+// Coordinator/worker protocol, in host byte order:
+//   Coordinator sends a hello: magic, version, width, height, samplesPerPass, seed
+//   Then, until it sends DONE, the coordinator sends TILE, pass, x, y, width,
+//   height and the worker answers with the tile's SampleBuffer as a blob
+static const uint32_t sProtocolMagic = 0x57445452; // "RTDW"
+static const uint32_t sProtocolVersion = 1;
+enum Message : uint32_t
+{
+    TILE = 0,
+    DONE,
+};
+
+void Render::setCoordinator(int port)
+{
+    mCoordinatorPort = port;
+}
+
+void Render::acceptWorkers()
+{
+    while (std::unique_ptr<Connection> connection = mListener->accept())
+    {
+        std::lock_guard<std::mutex> lock(mRemoteLock);
+        if (mRemoteDone)
+        {
+            break;
+        }
+        mConnectionThreads.emplace_back(&Render::serveWorker, this, std::move(connection));
+    }
+}
+
+void Render::serveWorker(std::unique_ptr<Connection> connection)
+{
+    bool haveTile = false;
+    TileScheduler::Tile tile;
+    try
+    {
+        connection->sendValue(sProtocolMagic);
+        connection->sendValue(sProtocolVersion);
+        connection->sendValue((int32_t)mWidth);
+        connection->sendValue((int32_t)mHeight);
+        connection->sendValue((int32_t)mSamplesPerPass);
+        connection->sendValue(mSeed);
+
+        while (true)
+        {
+            int pass;
+            {
+                std::unique_lock<std::mutex> lock(mRemoteLock);
+                mRemoteWork.wait(lock, [this]
+                                 { return mRemoteDone || !mRemoteTiles.empty(); });
+                if (mRemoteTiles.empty())
+                {
+                    break;
+                }
+                tile = mRemoteTiles.front();
+                mRemoteTiles.pop_front();
+                pass = mRemotePass;
+                haveTile = true;
+            }
+
+            connection->sendValue(TILE);
+            connection->sendValue((int32_t)pass);
+            connection->sendValue((int32_t)tile.mX);
+            connection->sendValue((int32_t)tile.mY);
+            connection->sendValue((int32_t)tile.mWidth);
+            connection->sendValue((int32_t)tile.mHeight);
+
+            std::istringstream blob(connection->receiveBlob());
+            SampleBuffer samples;
+            samples.read(blob);
+            if (samples.mWidth != tile.mWidth || samples.mHeight != tile.mHeight)
+            {
+                throw std::invalid_argument("Worker sent the wrong tile size");
+            }
+            mSamples.merge(samples, tile.mX, tile.mY);
+            haveTile = false;
+
+            mPixelsDone += tile.mWidth * tile.mHeight;
+            if (++mTilesDone == (int)mScheduler.numTiles())
+            {
+                std::lock_guard<std::mutex> lock(mPassDoneLock);
+                mPassDone.notify_all();
+            }
+        }
+        connection->sendValue(DONE);
+    }
+    catch (const std::exception &e)
+    {
+        std::cout << std::endl
+                  << "Lost worker: " << e.what() << std::endl;
+        if (haveTile)
+        {
+            // Someone else will have to render it
+            std::lock_guard<std::mutex> lock(mRemoteLock);
+            mRemoteTiles.push_back(tile);
+            mRemoteWork.notify_one();
+        }
+    }
+}
+
+/**
+ * @brief Connect to a coordinator and read its hello.
+ */
+static std::unique_ptr<Connection> connectToCoordinator(const std::string &address, int width, int height,
+                                                        int &samplesPerPass, uint64_t &seed)
+{
+    std::unique_ptr<Connection> connection = Connection::connect(address);
+    if (connection->receiveValue<uint32_t>() != sProtocolMagic ||
+        connection->receiveValue<uint32_t>() != sProtocolVersion)
+    {
+        throw std::invalid_argument("Not a coordinator, or from a different version");
+    }
+    if (connection->receiveValue<int32_t>() != width || connection->receiveValue<int32_t>() != height)
+    {
+        throw std::invalid_argument("Coordinator is rendering at a different resolution");
+    }
+    samplesPerPass = connection->receiveValue<int32_t>();
+    seed = connection->receiveValue<uint64_t>();
+    return connection;
+}
+
+void Render::runWorker(std::string address)
+{
+    std::vector<std::unique_ptr<Connection>> connections;
+    for (int i = 0; i < mJobs; i++)
+    {
+        int samplesPerPass;
+        uint64_t seed;
+        connections.push_back(connectToCoordinator(address, mWidth, mHeight, samplesPerPass, seed));
+        mSamplesPerPass = samplesPerPass;
+        mSeed = seed;
+    }
+    std::cout << "Connected to " << address << ", rendering tiles with " << mJobs << " threads..." << std::endl;
+
+    std::vector<Stats> stats(mJobs);
+    for (int i = 0; i < mJobs; i++)
+    {
+        stats[i].mPathLengths.resize(mMaxBounces + 1);
+        mThreads.emplace_back(&Render::renderRemoteTiles, this, std::move(connections[i]), std::ref(stats[i]));
+    }
+    for (auto &thread : mThreads)
+    {
+        thread.join();
+    }
+    mThreads.clear();
+
+    for (const Stats &s : stats)
+    {
+        mBvh.addStats(s.mBvh);
+        addStats(s);
+    }
+    printStats();
+}
+
+void Render::renderRemoteTiles(std::unique_ptr<Connection> connection, Stats &stats)
+{
+    try
+    {
+        while (connection->receiveValue<uint32_t>() == TILE)
+        {
+            int pass = connection->receiveValue<int32_t>();
+            TileScheduler::Tile tile;
+            tile.mX = connection->receiveValue<int32_t>();
+            tile.mY = connection->receiveValue<int32_t>();
+            tile.mWidth = connection->receiveValue<int32_t>();
+            tile.mHeight = connection->receiveValue<int32_t>();
+
+            // Only send back this pass's samples
+            mSamples.paste(SampleBuffer(tile.mWidth, tile.mHeight), tile.mX, tile.mY);
+            renderTile(tile, pass, stats);
+
+            std::ostringstream blob;
+            mSamples.crop(tile.mX, tile.mY, tile.mWidth, tile.mHeight).write(blob);
+            connection->sendBlob(blob.str());
+        }
+    }
+    catch (const std::exception &e)
+    {
+        std::cout << "Lost coordinator: " << e.what() << std::endl;
+    }
+}
+
 int Render::run()
 {
-    std::cout << "Using " << mHeight * mWidth * mAntiAliasingLevel << " rays." << std::endl;
+    std::cout << "Using " << (mAdaptive ? "up to " : "") << mHeight * mWidth * mAntiAliasingLevel << " rays." << std::endl;
+    std::cout << "Starting render with " << mJobs << " threads, " << mScheduler.numTiles() << " tiles";
+    if (mPasses > 1)
+    {
+        std::cout << ", " << mPasses << " passes";
+    }
+    if (mPassesDone > 0)
+    {
+        std::cout << ", resuming after pass " << mPassesDone;
+    }
+    std::cout << "..." << std::endl;
+
+    if (mCoordinatorPort >= 0)
+    {
+        if (mAdaptive)
+        {
+            throw std::invalid_argument("Adaptive sampling isn't supported with remote workers");
+        }
+        mListener = std::make_unique<Listener>(mCoordinatorPort);
+        mAcceptThread = std::thread(&Render::acceptWorkers, this);
+        std::cout << "Waiting for workers on port " << mCoordinatorPort << "..." << std::endl;
+    }
+
+    auto lastSnapshot = std::chrono::steady_clock::now();
+    auto lastCheckpoint = lastSnapshot;
+    for (int pass = mPassesDone; pass < mPasses; pass++)
+    {
+        runPass(pass);
+        mPassesDone = pass + 1;
+        if (mAdaptive && mPixelsSampled == 0)
+        {
+            // Every pixel has converged
+            break;
+        }
 
+        if (!mCheckpointPath.empty() && pass != mPasses - 1)
+        {
+            auto now = std::chrono::steady_clock::now();
+            if (now - lastCheckpoint >= std::chrono::seconds(mCheckpointSecondsInterval))
+            {
+                checkpoint();
+                lastCheckpoint = now;
+            }
+        }
+
+        if (mProgressive && pass != mPasses - 1)
+        {
+            auto now = std::chrono::steady_clock::now();
+            bool passDue = mSnapshotPassInterval > 0 && (pass + 1) % mSnapshotPassInterval == 0;
+            bool timeDue = mSnapshotSecondsInterval > 0 && now - lastSnapshot >= std::chrono::seconds(mSnapshotSecondsInterval);
+            if (passDue || timeDue)
+            {
+                snapshot();
+                lastSnapshot = now;
+            }
+        }
+    }
+    std::cout << std::endl;
+
+    if (mCoordinatorPort >= 0)
+    {
+        // Tell every worker we're done, then wait for them to hang up
+        {
+            std::lock_guard<std::mutex> lock(mRemoteLock);
+            mRemoteDone = true;
+            mRemoteWork.notify_all();
+        }
+        mListener->close();
+        mAcceptThread.join();
+        for (auto &thread : mConnectionThreads)
+        {
+            thread.join();
+        }
+        mConnectionThreads.clear();
+    }
+
+    if (!mCheckpointPath.empty())
+    {
+        // Finished, nothing left to resume
+        std::remove(mCheckpointPath.c_str());
+    }
+
+    printStats();
+    if (mAdaptive)
+    {
+        uint64_t samples = 0;
+        for (int i = 0; i < mWidth * mHeight; i++)
+        {
+            samples += mSamples.mCounts[i];
+        }
+        std::cout << "Adaptive sampling used " << samples << " rays, "
+                  << (double)samples / (mWidth * mHeight) << " per pixel on average." << std::endl;
+    }
+
+    return 0;
+}
+
+void Render::runPass(int pass)
+{
     // Create a pool of threads to dispatch jobs to.
-    // A job is just a pixel, really. Could even do it
-    // by each ray. It doesn't matter what order the pixels
-    // are rendered in, just that the final value is
+    // A job is a tile of pixels. It doesn't matter what order
+    // the tiles are rendered in, just that the final value is
     // written to the framebuffer.
-    std::cout << "Starting render with " << mJobs << " threads..." << std::endl;
-    for (int i = 0; i < mJobs; i++)
+    mScheduler.reset();
+    mPixelsDone = 0;
+    mTilesDone = 0;
+    mPixelsSampled = 0;
+    if (mCoordinatorPort >= 0)
     {
-        mThreads.emplace_back(std::thread(&Render::renderPixel, this));
+        // Queue every tile for the workers instead
+        std::lock_guard<std::mutex> lock(mRemoteLock);
+        TileScheduler::Tile tile;
+        while (mScheduler.next(0, tile))
+        {
+            mRemoteTiles.push_back(tile);
+        }
+        mRemotePass = pass;
+        mRemoteWork.notify_all();
+    }
+    else
+    {
+        for (int i = 0; i < mJobs; i++)
+        {
+            mThreads.emplace_back(std::thread(&Render::renderTiles, this, i));
+        }
     }
 
-    std::cout << "Started threads. Rendering..." << std::endl;
     while (true)
     {
-        mNextPixelLock.lock();
-        int nextX = mNextPixelX;
-        int nextY = mNextPixelY;
-        mNextPixelLock.unlock();
-
         // Lovely progress bar
         const int barWidth = 70;
-        const double progress = (((double)nextY * mWidth + nextX) / (mWidth * mHeight));
+        const double progress = (pass + (double)mPixelsDone / (mWidth * mHeight)) / mPasses;
         std::cout << "[";
         int pos = barWidth * progress;
         for (int i = 0; i < barWidth; ++i)
@@ -86,34 +547,95 @@ int Render::run()
             else
                 std::cout << " ";
         }
-        std::cout << "] " << int(progress * 100.0) << " %\r";
+        std::cout << "] " << int(progress * 100.0) << " %";
+        if (mProgressive)
+        {
+            std::cout << " (pass " << pass + 1 << "/" << mPasses << ")";
+        }
+        std::cout << "\r";
         std::cout.flush();
 
-        if (progress == 1)
+        std::unique_lock<std::mutex> lock(mPassDoneLock);
+        if (mPassDone.wait_for(lock, std::chrono::milliseconds(1000), [this]
+                               { return mTilesDone == (int)mScheduler.numTiles(); }))
         {
-            for (int i = 0; i < mJobs; i++)
-            {
-                mThreads[i].join();
-            }
             break;
         }
-        std::this_thread::sleep_for(std::chrono::milliseconds(1000));
     }
-    std::cout << std::endl;
 
-    return 0;
+    for (auto &thread : mThreads)
+    {
+        thread.join();
+    }
+    mThreads.clear();
 }
 
-int Render::save(std::string filename)
+void Render::resolve(enum HdrImage::ToneMap toneMap)
 {
-    std::ofstream out;
+    mSamples.average().toneMap(toneMap, mFb);
+}
 
-    // Binary
-    out.open(filename + ".ppm", std::ios::out | std::ios::binary);
+void Render::writePpm(std::string filename, const uint8_t *pixels)
+{
+    std::ofstream out;
+    out.open(filename, std::ios::out | std::ios::binary);
     out << "P6\n"
         << mWidth << " " << mHeight << "\n255\n";
-    out.write((const char *)mFb, mWidth * mHeight * 3);
+    out.write((const char *)pixels, mWidth * mHeight * 3);
     out.close();
+}
+
+void Render::writeHeatmap(std::string filename)
+{
+    std::vector<uint8_t> heatmap(mWidth * mHeight * 3);
+    for (int i = 0; i < mWidth * mHeight; i++)
+    {
+        // Ramp through red, then green, then blue as the count goes up
+        double heat = 3.0 * mSamples.mCounts[i] / mAntiAliasingLevel;
+        for (int c = 0; c < 3; c++)
+        {
+            double channel = MIN(MAX(heat - c, 0.0), 1.0);
+            heatmap[i * 3 + c] = (uint8_t)(channel * 255);
+        }
+    }
+    writePpm(filename, heatmap.data());
+}
+
+void Render::snapshot()
+{
+    // Write next to the real file and rename over it, rename is atomic
+    resolve(mSnapshotToneMap);
+    std::string path = mSnapshotPath + ".ppm";
+    writePpm(path + ".tmp", mFb);
+    if (std::rename((path + ".tmp").c_str(), path.c_str()) != 0)
+    {
+        std::cout << std::endl
+                  << "Failed to write snapshot " << path << ": " << std::strerror(errno) << std::endl;
+    }
+}
+
+int Render::save(std::string filename, enum HdrImage::ToneMap toneMap, bool saveSamples)
+{
+    std::ofstream out;
+
+    if (saveSamples)
+    {
+        out.open(filename + ".samples", std::ios::out | std::ios::binary);
+        mSamples.write(out);
+        out.close();
+    }
+
+    HdrImage hdr = mSamples.average();
+    hdr.writePfm(filename + ".pfm");
+    hdr.writeExr(filename + ".exr");
+    hdr.toneMap(toneMap, mFb);
+
+    // Binary
+    writePpm(filename + ".ppm", mFb);
+    if (mAdaptive)
+    {
+        writeHeatmap(filename + ".spp.ppm");
+    }
 
     // ASCII
     out.open(filename + ".txt.ppm");
@@ -133,84 +655,471 @@ int Render::save(std::string filename)
     return 0;
 }
 
-void Render::renderPixel()
+void Render::renderTiles(int worker)
 {
-    std::random_device rd;
-    randGen = std::mt19937(rd());
-    randDist = std::uniform_real_distribution<>(-1.0, 1.0);
-    while (!mKillThreads)
+    Stats stats;
+    stats.mPathLengths.resize(mMaxBounces + 1);
+    TileScheduler::Tile tile;
+    while (!mKillThreads && mScheduler.next(worker, tile))
     {
-        mNextPixelLock.lock();
-        int nextX = mNextPixelX;
-        int nextY = mNextPixelY;
-        if (nextY >= mHeight)
+        renderTile(tile, mPassesDone, stats);
+        mPixelsDone += tile.mWidth * tile.mHeight;
+        if (++mTilesDone == (int)mScheduler.numTiles())
         {
-            mNextPixelLock.unlock();
-            break;
-        }
-        else
-        {
-            mNextPixelX = (mNextPixelX + 1) % mWidth;
-            if (mNextPixelX == 0 && mNextPixelY < mHeight)
-            {
-                mNextPixelY++;
-            }
+            std::lock_guard<std::mutex> lock(mPassDoneLock);
+            mPassDone.notify_all();
         }
-        mNextPixelLock.unlock();
+    }
+    mBvh.addStats(stats.mBvh);
+    addStats(stats);
+}
 
-        Color pixelColor = {0.0, 0.0, 0.0};
-        for (int i = 0; i < mAntiAliasingLevel; i++)
-        {
-            Vector origin, dir;
-            getImgPlanePixelRandomDefocus(nextY, nextX, origin, dir);
-            Ray inRay = Ray(origin, dir);
+void Render::renderTile(const TileScheduler::Tile &tile, int pass, Stats &stats)
+{
+    if (mWavefront)
+    {
+        renderTileWavefront(tile, pass, stats);
+        return;
+    }
 
-            // Trace the ray. Keep tracing until we run out of bounces, miss everything, or we get absorbed.
-            for (int j = 0; j < mMaxBounces; j++)
+    // Go through the tile a packet sized block of pixels at a time.
+    // Each sample traces one camera ray per pixel in the block that
+    // still needs samples.
+    int packetWidth = (mPacketSize == 1) ? 1 : (mPacketSize == 4) ? 2 : 4;
+    int packetHeight = mPacketSize / packetWidth;
+    Ray rays[AccelerationStructure::sMaxPacketSize];
+    object::Hit hits[AccelerationStructure::sMaxPacketSize];
+    int indices[AccelerationStructure::sMaxPacketSize];
+    uint32_t firstSample = (uint32_t)pass * mSamplesPerPass;
+    for (int blockY = tile.mY; blockY < tile.mY + tile.mHeight; blockY += packetHeight)
+    {
+        for (int blockX = tile.mX; blockX < tile.mX + tile.mWidth; blockX += packetWidth)
+        {
+            int endY = MIN(blockY + packetHeight, tile.mY + tile.mHeight);
+            int endX = MIN(blockX + packetWidth, tile.mX + tile.mWidth);
+            for (int i = 0; i < mSamplesPerPass; i++)
             {
-                // Check BVH
-                Ray outRay;
-                double t = std::numeric_limits<double>::infinity();
-                Color color;
-                object::Primitive::Collision collision = mBvh.intersects(inRay, outRay, t, color);
-                inRay = Ray(outRay);
-
-                if (color.closeToZero())
+                int count = 0;
+                for (int y = blockY; y < endY; y++)
+                {
+                    for (int x = blockX; x < endX; x++)
+                    {
+                        int index = y * mWidth + x;
+                        if (converged(index))
+                        {
+                            continue;
+                        }
+                        Vector origin, dir;
+                        seedRandom(index, firstSample + i, 0);
+                        getImgPlanePixelRandomDefocus(y, x, firstSample + i, origin, dir);
+                        rays[count] = Ray(origin, dir);
+                        hits[count].mT = std::numeric_limits<double>::infinity();
+                        indices[count++] = index;
+                    }
+                }
+                if (count == 0)
                 {
-                    // Call the pixel black and move on, no point in simulating anything else
                     break;
                 }
-
-                if (collision == object::Primitive::Collision::REFLECTED)
+                if (i == 0)
                 {
-                    // We have more stuff to hit
-                    inRay.addCollision(color);
+                    mPixelsSampled += count;
                 }
-                else if (collision == object::Primitive::Collision::ABSORBED)
+                stats.mCameraRays += count;
+                mBvh.closestHitPacket(mScene, rays, hits, count, &stats.mBvh);
+                for (int k = 0; k < count; k++)
                 {
-                    // Ray was absorbed, we've found its final color
-                    inRay.addCollision(color);
-                    pixelColor.vadd(inRay.mColor);
-                    break;
+                    mSamples.add(indices[k], tracePath(rays[k], hits[k], indices[k], firstSample + i, stats));
                 }
-                else if (collision == object::Primitive::Collision::MISSED)
+            }
+        }
+    }
+}
+
+void Render::renderTileWavefront(const TileScheduler::Tile &tile, int pass, Stats &stats)
+{
+    // Camera rays go in packet sized blocks, all of a pixel's samples
+    // for the round in a row, so neighbouring paths start out coherent
+    int packetWidth = (mPacketSize == 1) ? 1 : (mPacketSize == 4) ? 2 : 4;
+    int packetHeight = mPacketSize / packetWidth;
+    int samplesPerRound = mAdaptive ? 1 : MAX(sWavefrontPaths / (tile.mWidth * tile.mHeight), 1);
+    Wavefront paths;
+    for (int done = 0; done < mSamplesPerPass; done += samplesPerRound)
+    {
+        int samples = MIN(samplesPerRound, mSamplesPerPass - done);
+        paths.mRays.clear();
+        paths.mPixels.clear();
+        paths.mSamples.clear();
+        for (int blockY = tile.mY; blockY < tile.mY + tile.mHeight; blockY += packetHeight)
+        {
+            for (int blockX = tile.mX; blockX < tile.mX + tile.mWidth; blockX += packetWidth)
+            {
+                int endY = MIN(blockY + packetHeight, tile.mY + tile.mHeight);
+                int endX = MIN(blockX + packetWidth, tile.mX + tile.mWidth);
+                for (int y = blockY; y < endY; y++)
                 {
-                    // Missed everything, meaning we never hit a light and
-                    // got absorbed. Give up and leave the pixel black
-                    break;
+                    for (int x = blockX; x < endX; x++)
+                    {
+                        int index = y * mWidth + x;
+                        if (converged(index))
+                        {
+                            continue;
+                        }
+                        if (done == 0)
+                        {
+                            mPixelsSampled++;
+                        }
+                        for (int i = 0; i < samples; i++)
+                        {
+                            uint32_t sample = (uint32_t)pass * mSamplesPerPass + done + i;
+                            Vector origin, dir;
+                            seedRandom(index, sample, 0);
+                            getImgPlanePixelRandomDefocus(y, x, sample, origin, dir);
+                            paths.mRays.push_back(Ray(origin, dir));
+                            paths.mPixels.push_back(index);
+                            paths.mSamples.push_back(sample);
+                        }
+                    }
                 }
             }
         }
-        pixelColor.vscale(1.0 / mAntiAliasingLevel); // Average our ray colors
-        pixelColor.vclip(1.0);
+        if (paths.mRays.empty())
+        {
+            break;
+        }
+        stats.mCameraRays += paths.mRays.size();
+        traceWavefront(paths, stats);
+    }
+}
+
+void Render::traceWavefront(Wavefront &paths, Stats &stats)
+{
+    Color black = {0.0, 0.0, 0.0};
+    size_t count = paths.mRays.size();
+    paths.mHits.resize(count);
+    paths.mRadiance.assign(count, black);
+    paths.mLengths.assign(count, 0);
+    paths.mActive.resize(count);
+    paths.mRandom.resize(count);
+    for (size_t p = 0; p < count; p++)
+    {
+        paths.mActive[p] = p;
+    }
+
+    for (int j = 0; j < mMaxBounces && !paths.mActive.empty(); j++)
+    {
+        // Extension: find the next hit of every active path. Camera
+        // rays are still in pixel order, so they go in packets.
+        for (uint32_t p : paths.mActive)
+        {
+            paths.mHits[p].mT = std::numeric_limits<double>::infinity();
+            paths.mLengths[p]++;
+        }
+        if (j == 0)
+        {
+            for (size_t p = 0; p < count; p += mPacketSize)
+            {
+                int packet = MIN((size_t)mPacketSize, count - p);
+                mBvh.closestHitPacket(mScene, &paths.mRays[p], &paths.mHits[p], packet, &stats.mBvh);
+            }
+        }
+        else
+        {
+            for (uint32_t p : paths.mActive)
+            {
+                // Volumes draw random numbers while intersecting
+                randGen = paths.mRandom[p];
+                mBvh.closestHit(mScene, paths.mRays[p], paths.mHits[p], &stats.mBvh);
+            }
+        }
 
-        mFbLock.lock();
-        uint8_t *pixel = getPixel(nextY, nextX);
-        pixel[R] = (uint8_t)(pixelColor[R] * 255);
-        pixel[G] = (uint8_t)(pixelColor[G] * 255);
-        pixel[B] = (uint8_t)(pixelColor[B] * 255);
-        mFbLock.unlock();
+        // Sort the paths that hit something by primitive, so each
+        // material's code and textures are used in one go. Paths that
+        // missed everything are done and leave the pixel black.
+        paths.mShadeOrder.clear();
+        for (uint32_t p : paths.mActive)
+        {
+            const object::Hit &hit = paths.mHits[p];
+            if (hit.mT < std::numeric_limits<double>::infinity())
+            {
+                uint64_t key = ((uint64_t)hit.mPrimitive.mType << 32) | hit.mPrimitive.mIndex;
+                paths.mShadeOrder.push_back({key, p});
+            }
+        }
+        std::sort(paths.mShadeOrder.begin(), paths.mShadeOrder.end());
+
+        // Shading. Light sampling only queues up the shadow rays. Paths
+        // that keep bouncing go back in the active queue.
+        paths.mActive.clear();
+        paths.mShadowRays.clear();
+        for (const std::pair<uint64_t, uint32_t> &entry : paths.mShadeOrder)
+        {
+            uint32_t p = entry.second;
+            ShadowRay shadow;
+            bool hasShadowRay;
+            bool bouncing = shadeHit(paths.mRays[p], paths.mHits[p], paths.mPixels[p], paths.mSamples[p], j,
+                                     paths.mRadiance[p], shadow, hasShadowRay, stats);
+            if (hasShadowRay)
+            {
+                shadow.mPath = p;
+                paths.mShadowRays.push_back(shadow);
+            }
+            if (bouncing)
+            {
+                paths.mRandom[p] = randGen;
+                paths.mActive.push_back(p);
+            }
+        }
+
+        // Shadow rays, only the light from unblocked ones counts
+        for (const ShadowRay &shadow : paths.mShadowRays)
+        {
+            randGen = shadow.mRandom;
+            if (!mBvh.occluded(mScene, shadow.mRay, shadow.mTMax, &stats.mBvh))
+            {
+                paths.mRadiance[shadow.mPath].vadd(shadow.mColor);
+            }
+        }
+    }
+
+    for (size_t p = 0; p < count; p++)
+    {
+        mSamples.add(paths.mPixels[p], paths.mRadiance[p]);
+        stats.mBounceRays += MAX(paths.mLengths[p] - 1, 0);
+        stats.mPathLengths[paths.mLengths[p]]++;
+    }
+}
+
+Color Render::tracePath(Ray inRay, const object::Hit &primaryHit, int pixel, uint32_t sample, Stats &stats)
+{
+    Color pixelColor = {0.0, 0.0, 0.0};
+
+    // Trace the ray. Keep tracing until we run out of bounces, miss everything, or we get absorbed.
+    int rays = 0;
+    for (int j = 0; j < mMaxBounces; j++)
+    {
+        // Check BVH. The camera ray's hit is already known.
+        object::Hit hit = primaryHit;
+        if (j > 0)
+        {
+            hit.mT = std::numeric_limits<double>::infinity();
+            mBvh.closestHit(mScene, inRay, hit, &stats.mBvh);
+        }
+        rays++;
+        if (hit.mT == std::numeric_limits<double>::infinity())
+        {
+            // Missed everything, meaning we never hit a light and
+            // got absorbed. Give up and leave the pixel black
+            break;
+        }
+
+        ShadowRay shadow;
+        bool hasShadowRay;
+        bool bouncing = shadeHit(inRay, hit, pixel, sample, j, pixelColor, shadow, hasShadowRay, stats);
+        if (hasShadowRay)
+        {
+            // Tested with the generator state it was cast with, like
+            // traceWavefront() does, then the path carries on from where
+            // shading left off
+            Pcg32 pathRandom = randGen;
+            randGen = shadow.mRandom;
+            if (!mBvh.occluded(mScene, shadow.mRay, shadow.mTMax, &stats.mBvh))
+            {
+                pixelColor.vadd(shadow.mColor);
+            }
+            randGen = pathRandom;
+        }
+        if (!bouncing)
+        {
+            break;
+        }
+    }
+    stats.mBounceRays += MAX(rays - 1, 0);
+    stats.mPathLengths[rays]++;
+    return pixelColor;
+}
+
+bool Render::shadeHit(Ray &ray, const object::Hit &hit, int pixel, uint32_t sample, int depth,
+                      Color &radiance, ShadowRay &shadow, bool &hasShadowRay, Stats &stats)
+{
+    hasShadowRay = false;
+    seedRandom(pixel, sample, depth + 1);
+    mSampler.get2D(mSeed, pixel, sample, Sampler::sBounceDimension + depth, ray.mScatterSample[0], ray.mScatterSample[1]);
+    Ray outRay = ray;
+    Color color;
+    object::Primitive::Collision collision = mScene.shade(hit, outRay, color);
+    double weight = 1.0;
+    if (collision == object::Primitive::Collision::ABSORBED && mNextEventEstimation)
+    {
+        weight = emissionWeight(ray, outRay, hit.mT);
+    }
+    ray = outRay;
+
+    if (color.closeToZero())
+    {
+        // Call the path black and move on, no point in simulating anything else
+        return false;
+    }
+
+    if (collision == object::Primitive::Collision::REFLECTED)
+    {
+        // We have more stuff to hit
+        ray.addCollision(color);
+        if (mNextEventEstimation && ray.mBounceSurface == Color::Surface::DIFFUSE && depth + 1 < mMaxBounces &&
+            prepareShadowRay(ray, shadow, stats))
+        {
+            shadow.mRandom = randGen;
+            hasShadowRay = true;
+        }
+
+        if (depth + 1 >= mRouletteDepth)
+        {
+            // Russian roulette. Dim paths add little to the image, so
+            // end most of them early and make up for it by scaling
+            // up the survivors.
+            double survival = MIN(MAX(MAX(ray.mColor[R], ray.mColor[G]), ray.mColor[B]), 1.0);
+            if (randomDouble() >= survival)
+            {
+                return false;
+            }
+            ray.mColor.vscale(1.0 / survival);
+        }
+        return true;
+    }
+    if (collision == object::Primitive::Collision::ABSORBED)
+    {
+        // Ray was absorbed, we've found its final color
+        ray.addCollision(color);
+        radiance.vadd(ray.mColor.vscale(weight));
+    }
+    return false;
+}
+
+void Render::seedRandom(int pixel, uint32_t sample, int bounce) const
+{
+    uint64_t path = ((uint64_t)pixel << 32) | sample;
+    randGen.seed(Pcg32::hash(mSeed ^ Pcg32::hash(path ^ Pcg32::hash(bounce))));
+}
+
+void Render::addStats(const Stats &stats)
+{
+    std::lock_guard<std::mutex> lock(mStatsLock);
+    mStats.mCameraRays += stats.mCameraRays;
+    mStats.mBounceRays += stats.mBounceRays;
+    mStats.mShadowRays += stats.mShadowRays;
+    for (size_t i = 0; i < stats.mPathLengths.size(); i++)
+    {
+        mStats.mPathLengths[i] += stats.mPathLengths[i];
+    }
+}
+
+void Render::printStats()
+{
+    std::lock_guard<std::mutex> lock(mStatsLock);
+    uint64_t rays = mStats.mCameraRays + mStats.mBounceRays + mStats.mShadowRays;
+    std::cout << "Traced " << rays << " rays: " << mStats.mCameraRays << " camera, "
+              << mStats.mBounceRays << " bounced, " << mStats.mShadowRays << " shadow." << std::endl;
+    if (mStats.mCameraRays == 0)
+    {
+        return;
+    }
+
+    // Rays traced per path, not counting shadow rays
+    std::cout << "Path lengths:" << std::endl;
+    for (size_t i = 0; i < mStats.mPathLengths.size(); i++)
+    {
+        if (mStats.mPathLengths[i] > 0)
+        {
+            std::cout << "  " << i << ": " << mStats.mPathLengths[i] << " ("
+                      << 100.0 * mStats.mPathLengths[i] / mStats.mCameraRays << "%)" << std::endl;
+        }
+    }
+    std::cout << "Average path length: " << (double)(mStats.mCameraRays + mStats.mBounceRays) / mStats.mCameraRays << std::endl;
+}
+
+/**
+ * @brief Power heuristic for multiple importance sampling with one
+ * sample from each strategy (Veach, beta = 2).
+ */
+static inline double powerHeuristic(double pdf, double otherPdf)
+{
+    return (pdf * pdf) / (pdf * pdf + otherPdf * otherPdf);
+}
+
+bool Render::prepareShadowRay(const Ray &ray, ShadowRay &shadow, Stats &stats)
+{
+    const std::vector<const object::Primitive *> &lights = mScene.mLights;
+    if (lights.empty())
+    {
+        return false;
+    }
+    const object::Primitive *light = lights[MIN((size_t)(randomDouble() * lights.size()), lights.size() - 1)];
+
+    Vector dir;
+    double lightPdf;
+    if (!light->sampleLight(ray.mOrigin, dir, lightPdf))
+    {
+        return false;
+    }
+    double cosTheta = Vector::dot(dir, ray.mBounceNormal);
+    if (cosTheta <= 0.0)
+    {
+        // Diffuse bounces never go below the surface
+        return false;
+    }
+
+    // Shadow ray. Find where it reaches the light, the light is only
+    // visible if nothing blocks the ray before that.
+    shadow.mRay = Ray(ray.mOrigin, dir);
+    stats.mShadowRays++;
+    object::Hit hit;
+    hit.mT = std::numeric_limits<double>::infinity();
+    if (!light->intersect(shadow.mRay, hit))
+    {
+        return false;
+    }
+    shadow.mTMax = hit.mT * (1.0 - EPSILON);
+    Ray lightRay = shadow.mRay;
+    Color emission;
+    light->shade(hit, lightRay, emission);
+
+    // The diffuse BRDF is color / pi and ray.mColor already has the
+    // color in it, so this is BRDF * cos / pdf with the pi canceled out
+    lightPdf /= lights.size();
+    double bsdfPdf = cosTheta / M_PI;
+    shadow.mColor = Color::attenuate(ray.mColor, emission);
+    shadow.mColor.vscale(bsdfPdf / lightPdf * powerHeuristic(lightPdf, bsdfPdf));
+    return true;
+}
+
+double Render::emissionWeight(const Ray &incoming, const Ray &outgoing, double t)
+{
+    if (incoming.mBounceSurface != Color::Surface::DIFFUSE ||
+        outgoing.mBounceSurface != Color::Surface::EMISSIVE ||
+        !outgoing.mBouncePrimitive->mIsLight)
+    {
+        return 1.0;
+    }
+    Vector point = Vector::svadd(incoming.mOrigin, Vector::svscale(incoming.mDir, t));
+    double lightPdf = outgoing.mBouncePrimitive->lightPdf(incoming.mOrigin, point, outgoing.mBounceNormal) / mScene.mLights.size();
+    double bsdfPdf = MAX(Vector::dot(incoming.mDir, incoming.mBounceNormal), 0.0) / M_PI;
+    return powerHeuristic(bsdfPdf, lightPdf);
+}
+
+bool Render::converged(int index)
+{
+    double n = mSamples.mCounts[index];
+    if (!mAdaptive || n < mMinSamples)
+    {
+        return false;
+    }
+    if (n >= mAntiAliasingLevel)
+    {
+        return true;
     }
+    double mean = mSamples.mLuminance[index * 2] / n;
+    double variance = MAX(mSamples.mLuminance[index * 2 + 1] / n - mean * mean, 0.0) * n / (n - 1);
+    return sConfidenceZ * std::sqrt(variance / n) < mAdaptiveThreshold;
 }
 
 uint8_t *Render::getPixel(int y, int x)
@@ -256,12 +1165,15 @@ void Render::setupImgPlane()
     mPlaneOrigin.vadd(mScene.mCamera.mOrigin, Vector::svsub(halfTop, halfWidth));
 }
 
-void Render::getImgPlanePixelRandomDefocus(int y, int x, Vector &origin, Vector &dir)
+void Render::getImgPlanePixelRandomDefocus(int y, int x, uint32_t sample, Vector &origin, Vector &dir)
 {
     // Find a random point on the lens disk, shoot it through the center of
     // an image plane pixel
-    double randomRadius = randomDouble() * mScene.mCamera.mLensDiskDiameter;
-    double randomAngle = randomDouble() * 2.0 * M_PI;
+    int pixel = y * mWidth + x;
+    double lensU, lensV;
+    mSampler.get2D(mSeed, pixel, sample, Sampler::sLensDimension, lensU, lensV);
+    double randomRadius = lensU * mScene.mCamera.mLensDiskDiameter;
+    double randomAngle = lensV * 2.0 * M_PI;
 
     // Convert polar to cartesian, scale relative to camera axes, add in camera origin
     Vector camRight = Vector::scross3(mScene.mCamera.mFront, mScene.mCamera.mTop).vnorm();
@@ -270,8 +1182,10 @@ void Render::getImgPlanePixelRandomDefocus(int y, int x, Vector &origin, Vector
     Vector randomLensPoint = Vector::svadd(mPinhole, Vector::svadd(randomX, randomY));
 
     // Randomize location inside image plane pixel
-    Vector dx = Vector::svscale(mPlaneWidth, x + randomDouble());
-    Vector dy = Vector::svscale(mPlaneHeight, y + randomDouble());
+    double pixelU, pixelV;
+    mSampler.get2D(mSeed, pixel, sample, Sampler::sPixelDimension, pixelU, pixelV);
+    Vector dx = Vector::svscale(mPlaneWidth, x + pixelU);
+    Vector dy = Vector::svscale(mPlaneHeight, y + pixelV);
 
     // Find vector to image plane pixel, then find vector between lens and
     // image plane pixel
@@ -4,15 +4,25 @@
 #include <string>
 #include <vector>
 #include <thread>
+#include <atomic>
 #include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <memory>
 #include "scene.hpp"
 #include "ray.hpp"
-#include "bvh.hpp"
+#include "accelerationStructure.hpp"
+#include "tileScheduler.hpp"
+#include "hdrImage.hpp"
+#include "sampleBuffer.hpp"
+#include "random.hpp"
+#include "sampler.hpp"
+#include "network.hpp"
 
 class Render
 {
 public:
-    Render(Scene &scene, BoundingVolumeHierarchy &bvh, int width, int height, int antiAliasingLevel, int jobs, int maxBounces);
+    Render(Scene &scene, AccelerationStructure &bvh, int width, int height, int antiAliasingLevel, int jobs, int maxBounces, int tileSize);
     ~Render();
 
     /**
@@ -23,41 +33,399 @@ public:
     int run();
 
     /**
-     * @brief Saves the rendered framebuffer to two PPM
-     * files: filename.ppm (binary) and filename.txt.ppm
-     * (ASCII).
+     * @brief Render progressively instead of pixel by pixel: every
+     * pass adds one sample to every pixel of the frame, and a snapshot
+     * of the image so far is written to snapshotPath every few passes
+     * or seconds. Call before run().
+     *
+     * @param snapshotPath Snapshot file, without the .ppm extension
+     * @param passInterval Passes between snapshots, 0 to disable
+     * @param secondsInterval Seconds between snapshots, 0 to disable
+     * @param toneMap Tone mapping for the snapshots
+     */
+    void setProgressive(std::string snapshotPath, int passInterval, int secondsInterval, enum HdrImage::ToneMap toneMap);
+
+    /**
+     * @brief Stop sampling a pixel once the 95% confidence interval of
+     * its luminance is narrower than +/- threshold. Pixels always get
+     * at least minSamples and at most antiAliasingLevel samples. Call
+     * before run().
+     *
+     * @param threshold Half width of the confidence interval, in
+     * display units where 1.0 is full white
+     * @param minSamples Samples to take before checking convergence
+     */
+    void setAdaptive(double threshold, int minSamples);
+
+    /**
+     * @brief Turn next event estimation on or off. When on (the
+     * default), every diffuse bounce also samples a random light in
+     * Scene::mLights with a shadow ray, and combines it with the
+     * bounced ray using multiple importance sampling.
+     */
+    void setNextEventEstimation(bool enabled);
+
+    /**
+     * @brief Randomly end paths after minDepth bounces, with a chance
+     * of surviving equal to the brightest channel of the ray's color.
+     * Paths that survive are brightened to make up for the ones that
+     * didn't, so the image stays unbiased. minDepth >= the max depth
+     * turns it off. Default: 3.
+     */
+    void setRussianRoulette(int minDepth);
+
+    /**
+     * @brief Trace camera rays in packets of 4 (2x2 pixels), 8 (4x2) or
+     * 16 (4x4) with AccelerationStructure::closestHitPacket(). Only the
+     * first hit is found together, bounces are traced one ray at a time.
+     * 1 turns packets off. Throws std::invalid_argument for any other
+     * size. Default: 1.
+     */
+    void setPacketSize(int size);
+
+    /**
+     * @brief Render in wavefront mode instead of tracing each path from
+     * start to finish. Every tile keeps a batch of paths in flight and
+     * runs each stage (finding hits, shading, shadow rays) over the
+     * whole batch before starting the next, shading paths grouped by the
+     * primitive they hit. Converges to the same image, but with
+     * volumes in the scene a seeded render isn't bit-identical to one
+     * without. Off by default.
+     */
+    void setWavefront(bool enabled);
+
+    /**
+     * @brief Where the pixel, lens and diffuse bounce samples come from:
+     * independent random numbers (the default), or a scrambled Sobol
+     * sequence, per pixel or shared and offset by blue noise. The Sobol
+     * samplers reach the same noise level with fewer samples per pixel.
+     */
+    void setSampler(enum Sampler::Type type);
+
+    /**
+     * @brief Seed for the random number generators. The generators are
+     * reseeded from it, the pixel, the sample and the bounce for every
+     * bounce of every path, so a render with the same seed and settings
+     * is the same no matter how many jobs it runs with or where it was
+     * resumed, and any pixel can be rendered again on its own. Random by
+     * default.
+     */
+    void setSeed(uint64_t seed);
+
+    /**
+     * @brief Save everything needed to resume the render to a file
+     * between passes, at most every secondsInterval seconds. Like
+     * progressive rendering, this renders one sample per pixel per
+     * pass, so at most one pass is lost if the render is killed. The
+     * file is removed once the render finishes. Call before run().
+     */
+    void setCheckpoint(std::string checkpointPath, int secondsInterval);
+
+    /**
+     * @brief Continue from a file written by setCheckpoint(). Render
+     * must have been constructed with the same settings as the render
+     * that wrote it. Throws std::invalid_argument if the file doesn't
+     * match. Call before run().
+     */
+    void resume(std::string checkpointPath);
+
+    /**
+     * @brief Don't render anything locally. Instead, run() listens on
+     * a TCP port and hands each pass's tiles out to worker processes
+     * started with runWorker(), and adds the samples they send back
+     * to this render. Workers can come and go during the render, a
+     * tile that's lost with a worker is handed out again. Can't be
+     * combined with adaptive sampling. Call before run().
+     */
+    void setCoordinator(int port);
+
+    /**
+     * @brief Render tiles for a coordinator until it's done, instead
+     * of calling run(). Every job opens its own connection. The
+     * coordinator decides the seed and samples per pass, everything
+     * else (scene, resolution, max depth, ...) has to be set up the
+     * same as on the coordinator. Since tiles are seeded the same way
+     * everywhere, the result is identical to a local render with the
+     * same seed and tile size.
+     *
+     * @param address Coordinator's host:port
+     */
+    void runWorker(std::string address);
+
+    /**
+     * @brief Saves the rendered image. The unclipped average of the
+     * samples is saved to filename.pfm and filename.exr, and it's tone
+     * mapped to 24 bit color for filename.ppm (binary) and
+     * filename.txt.ppm (ASCII). With adaptive sampling, the number of
+     * samples per pixel is also saved as a heatmap to filename.spp.ppm.
+     *
+     * If saveSamples is set, the sample sums are also saved to
+     * filename.samples, for the merge tool.
      *
      * @param filename
+     * @param toneMap Tone mapping for the 24 bit images
+     * @param saveSamples Also save the sample buffer
      * @return int
      */
-    int save(std::string filename);
+    int save(std::string filename, enum HdrImage::ToneMap toneMap = HdrImage::CLAMP, bool saveSamples = false);
 
 private:
+    // Per worker counters, merged into mStats when the worker is done
+    struct Stats
+    {
+        AccelerationStructure::Stats mBvh;
+        uint64_t mCameraRays = 0;
+        uint64_t mBounceRays = 0;
+        uint64_t mShadowRays = 0;
+        std::vector<uint64_t> mPathLengths; // mPathLengths[n] is the number of paths that traced n rays
+    };
+
+    // Next event estimation shadow ray, and the light it brings if
+    // nothing blocks it
+    struct ShadowRay
+    {
+        Ray mRay;
+        double mTMax;   // Time the ray reaches the light
+        Color mColor;
+        uint32_t mPath; // Path it was cast from, in wavefront mode
+        Pcg32 mRandom;  // Random number generator state to test it with
+    };
+
+    // Paths in flight in wavefront mode. Per path state is kept in
+    // parallel arrays indexed by path, and the stages walk queues of
+    // path indices.
+    struct Wavefront
+    {
+        std::vector<Ray> mRays;         // Ray each path traces next
+        std::vector<object::Hit> mHits; // Closest hit of that ray
+        std::vector<Color> mRadiance;   // Light each path has collected
+        std::vector<int> mPixels;       // Pixel each path is a sample of
+        std::vector<uint32_t> mSamples; // Which sample of the pixel it is
+        std::vector<Pcg32> mRandom;     // Random number generator state each path left off at
+        std::vector<int> mLengths;      // Rays each path has traced
+        std::vector<uint32_t> mActive;  // Paths still bouncing
+        std::vector<std::pair<uint64_t, uint32_t>> mShadeOrder; // Paths that hit something, keyed by the primitive
+        std::vector<ShadowRay> mShadowRays;
+    };
+
     Scene &mScene;
 
-    BoundingVolumeHierarchy &mBvh;
+    AccelerationStructure &mBvh;
 
     int mWidth, mHeight, mAntiAliasingLevel;
-    uint8_t *mFb;
-    std::mutex mFbLock;
+    SampleBuffer mSamples; // All samples so far. Tiles are disjoint, so workers write here without locking
+    uint8_t *mFb;          // mSamples averaged and tone mapped to 24 bit color by resolve()
 
     int mJobs;
     std::vector<std::thread> mThreads;
-    int mNextPixelX, mNextPixelY;
-    std::mutex mNextPixelLock;
+    TileScheduler mScheduler;
+    std::atomic<int> mPixelsDone; // Progress counters, read by run()
+    std::atomic<int> mTilesDone;
+    std::atomic<int> mPixelsSampled; // Pixels that weren't converged yet this pass
+    std::mutex mPassDoneLock;
+    std::condition_variable mPassDone; // Signaled when the last tile of a pass is done
     bool mKillThreads;
 
+    int mPasses;         // Number of passes over the whole image
+    int mPassesDone;     // Passes in mSamples, nonzero when resuming
+    int mSamplesPerPass; // Max samples per pixel in each pass
+
+    bool mProgressive;
+    std::string mSnapshotPath;
+    int mSnapshotPassInterval, mSnapshotSecondsInterval;
+    enum HdrImage::ToneMap mSnapshotToneMap;
+
+    uint64_t mSeed;
+    std::string mCheckpointPath; // Empty if checkpoints are off
+    int mCheckpointSecondsInterval;
+
+    // Coordinator state. Tiles of the current pass waiting for a worker
+    // are in mRemoteTiles, protected by mRemoteLock.
+    int mCoordinatorPort; // -1 if not a coordinator
+    std::unique_ptr<Listener> mListener;
+    std::thread mAcceptThread;
+    std::vector<std::thread> mConnectionThreads;
+    std::mutex mRemoteLock;
+    std::condition_variable mRemoteWork; // Signaled when tiles are added or the render is done
+    std::deque<TileScheduler::Tile> mRemoteTiles;
+    int mRemotePass;
+    bool mRemoteDone;
+
+    static constexpr double sConfidenceZ = 1.96; // z-score of a 95% confidence interval
+    bool mAdaptive;
+    double mAdaptiveThreshold;
+    int mMinSamples;
+
     int mMaxBounces; // Max bounces per ray before we call it black
+    bool mNextEventEstimation;
+    int mRouletteDepth; // Bounces before Russian roulette starts
+    int mPacketSize;    // Camera rays traced together
+    bool mWavefront;
+    Sampler mSampler;
+
+    static constexpr int sWavefrontPaths = 4096; // Paths in flight per tile in wavefront mode, roughly
+
+    Stats mStats;
+    std::mutex mStatsLock;
 
     Vector mPlaneWidth, mPlaneHeight, mPlaneOrigin; // Width/heights are normalized, origin is top left corner
     Vector mPinhole;                                // Location of the pinhole camera
 
     /**
      * @brief Job for an individual thread in the thread
-     * pool. Renders the next pixel in the queue and puts
-     * the result in the framebuffer.
+     * pool. Renders tiles from the scheduler until there
+     * are none left and puts the results in the framebuffer.
+     */
+    void renderTiles(int worker);
+
+    /**
+     * @brief Render the samples of one pass for every pixel in a
+     * tile into mSamples.
+     */
+    void renderTile(const TileScheduler::Tile &tile, int pass, Stats &stats);
+
+    /**
+     * @brief renderTile() in wavefront mode. Generates the tile's camera
+     * rays in rounds of up to sWavefrontPaths paths and traces each
+     * round with traceWavefront(). With adaptive sampling a round is
+     * one sample per unconverged pixel.
+     */
+    void renderTileWavefront(const TileScheduler::Tile &tile, int pass, Stats &stats);
+
+    /**
+     * @brief Trace every path in paths to the end, one stage at a time
+     * for the whole batch, compacting away finished paths after every
+     * bounce. Adds the finished samples to mSamples.
+     */
+    void traceWavefront(Wavefront &paths, Stats &stats);
+
+    /**
+     * @brief Coordinator thread accepting worker connections.
+     */
+    void acceptWorkers();
+
+    /**
+     * @brief Coordinator thread handing tiles to one worker connection.
+     */
+    void serveWorker(std::unique_ptr<Connection> connection);
+
+    /**
+     * @brief Worker thread rendering tiles for a coordinator.
+     */
+    void renderRemoteTiles(std::unique_ptr<Connection> connection, Stats &stats);
+
+    /**
+     * @brief Follow a camera ray's path and return its color.
+     *
+     * @param primaryHit Closest hit of the camera ray, already found
+     * with the rest of its packet. mT is infinite if it missed.
+     * @param pixel, sample Which sample of which pixel the path is, to
+     * seed the random number generator with
+     */
+    Color tracePath(Ray inRay, const object::Hit &primaryHit, int pixel, uint32_t sample, Stats &stats);
+
+    /**
+     * @brief Shade one hit of a path, for both tracePath() and
+     * traceWavefront(). Seeds the random number generator for the
+     * bounce, scatters the ray, adds any light found there (weighted
+     * for multiple importance sampling), sets up next event estimation
+     * and plays Russian roulette.
+     *
+     * @param ray The path's ray, becomes the scattered ray
+     * @param hit Where ray hit something, mT must be finite
+     * @param depth Index of the hit in the path, 0 for the camera ray's
+     * @param radiance Gets the light found at the hit added to it
+     * @param shadow Shadow ray towards a light, for the caller to test.
+     * Only set if hasShadowRay is.
+     * @return true if the path keeps bouncing
+     */
+    bool shadeHit(Ray &ray, const object::Hit &hit, int pixel, uint32_t sample, int depth,
+                  Color &radiance, ShadowRay &shadow, bool &hasShadowRay, Stats &stats);
+
+    /**
+     * @brief Seed this thread's random number generator for one stretch
+     * of a path. Each path gets the same random numbers whichever
+     * thread, tile or batch traces it.
+     *
+     * @param sample Index of the sample in the pixel, counting every pass
+     * @param bounce 0 for the camera ray, j + 1 for everything from
+     * shading the path's j-th hit up to finding the next one
+     */
+    void seedRandom(int pixel, uint32_t sample, int bounce) const;
+
+    /**
+     * @brief Next event estimation. Pick a random light and a shadow
+     * ray to it from the point a ray just diffusely bounced off of, and
+     * work out the light it adds if nothing blocks the shadow ray,
+     * weighted for multiple importance sampling. ray's color must
+     * already include the surface color. Returns false if it can't add
+     * anything.
+     */
+    bool prepareShadowRay(const Ray &ray, ShadowRay &shadow, Stats &stats);
+
+    /**
+     * @brief Multiple importance sampling weight for light found by
+     * bouncing a ray into an emissive primitive, so it isn't counted
+     * twice with prepareShadowRay(). 1 if the light couldn't have been
+     * found by prepareShadowRay().
+     *
+     * @param incoming Ray that hit the light
+     * @param outgoing Same ray after colliding with the light
+     * @param t Time of the collision
+     */
+    double emissionWeight(const Ray &incoming, const Ray &outgoing, double t);
+
+    /**
+     * @brief Merge a worker's counters into mStats. Thread safe.
+     */
+    void addStats(const Stats &stats);
+
+    /**
+     * @brief Print the ray counts and path length histogram.
+     */
+    void printStats();
+
+    /**
+     * @brief Check if a pixel has enough samples. Always false
+     * without adaptive sampling.
+     */
+    bool converged(int index);
+
+    /**
+     * @brief Render every tile of the image once with the thread
+     * pool. Blocks until the pass is done, updating the progress bar.
+     */
+    void runPass(int pass);
+
+    /**
+     * @brief Average the accumulated samples and tone map them into
+     * the 24 bit framebuffer.
+     */
+    void resolve(enum HdrImage::ToneMap toneMap);
+
+    /**
+     * @brief Write a 24 bit image the size of the framebuffer to a
+     * binary PPM file.
+     */
+    void writePpm(std::string filename, const uint8_t *pixels);
+
+    /**
+     * @brief Write the number of samples each pixel got as a heatmap,
+     * black for none through red and yellow to white for the max.
+     */
+    void writeHeatmap(std::string filename);
+
+    /**
+     * @brief Write the render state to the checkpoint file. The file
+     * is replaced atomically like the snapshot.
+     */
+    void checkpoint();
+
+    /**
+     * @brief Write the image so far to the snapshot file. The file is
+     * replaced atomically, so readers never see a partial image.
      */
-    void renderPixel();
+    void snapshot();
 
     /**
      * @brief Get a pointer to the pixel in the framebuffer
@@ -73,7 +441,8 @@ private:
 
     /**
      * @brief Get a vector coming from a particular pixel in the image
-     * plane specified by x, y, accounting for defocus blur.
+     * plane specified by x, y, accounting for defocus blur. sample is
+     * the index of the sample in the pixel, for mSampler.
      */
-    void getImgPlanePixelRandomDefocus(int y, int x, Vector &origin, Vector &dir);
+    void getImgPlanePixelRandomDefocus(int y, int x, uint32_t sample, Vector &origin, Vector &dir);
 };
\ No newline at end of file
@@ -0,0 +1,114 @@
+#include <cstring>
+#include <stdexcept>
+#include "sampleBuffer.hpp"
+
+static const uint32_t sMagic = 0x42535452; // "RTSB"
+static const uint32_t sVersion = 1;
+
+SampleBuffer::SampleBuffer() : mWidth(0), mHeight(0) {}
+
+SampleBuffer::SampleBuffer(int width, int height)
+    : mWidth(width), mHeight(height), mSums(width * height * 3, 0.0f),
+      mCounts(width * height, 0), mLuminance(width * height * 2, 0.0) {}
+
+void SampleBuffer::merge(const SampleBuffer &other, int x, int y)
+{
+    if (x < 0 || y < 0 || x + other.mWidth > mWidth || y + other.mHeight > mHeight)
+    {
+        throw std::invalid_argument("Merged sample buffer doesn't fit");
+    }
+    for (int row = 0; row < other.mHeight; row++)
+    {
+        int from = row * other.mWidth;
+        int to = (y + row) * mWidth + x;
+        for (int i = 0; i < other.mWidth; i++)
+        {
+            for (int c = 0; c < 3; c++)
+            {
+                mSums[(to + i) * 3 + c] += other.mSums[(from + i) * 3 + c];
+            }
+            mCounts[to + i] += other.mCounts[from + i];
+            mLuminance[(to + i) * 2] += other.mLuminance[(from + i) * 2];
+            mLuminance[(to + i) * 2 + 1] += other.mLuminance[(from + i) * 2 + 1];
+        }
+    }
+}
+
+SampleBuffer SampleBuffer::crop(int x, int y, int width, int height) const
+{
+    if (x < 0 || y < 0 || width < 0 || height < 0 || x + width > mWidth || y + height > mHeight)
+    {
+        throw std::invalid_argument("Crop is outside of the sample buffer");
+    }
+    SampleBuffer out(width, height);
+    for (int row = 0; row < height; row++)
+    {
+        int from = (y + row) * mWidth + x;
+        int to = row * width;
+        std::memcpy(&out.mSums[to * 3], &mSums[from * 3], width * 3 * sizeof(float));
+        std::memcpy(&out.mCounts[to], &mCounts[from], width * sizeof(uint32_t));
+        std::memcpy(&out.mLuminance[to * 2], &mLuminance[from * 2], width * 2 * sizeof(double));
+    }
+    return out;
+}
+
+void SampleBuffer::paste(const SampleBuffer &other, int x, int y)
+{
+    if (x < 0 || y < 0 || x + other.mWidth > mWidth || y + other.mHeight > mHeight)
+    {
+        throw std::invalid_argument("Paste is outside of the sample buffer");
+    }
+    for (int row = 0; row < other.mHeight; row++)
+    {
+        int from = row * other.mWidth;
+        int to = (y + row) * mWidth + x;
+        std::memcpy(&mSums[to * 3], &other.mSums[from * 3], other.mWidth * 3 * sizeof(float));
+        std::memcpy(&mCounts[to], &other.mCounts[from], other.mWidth * sizeof(uint32_t));
+        std::memcpy(&mLuminance[to * 2], &other.mLuminance[from * 2], other.mWidth * 2 * sizeof(double));
+    }
+}
+
+HdrImage SampleBuffer::average() const
+{
+    HdrImage hdr(mWidth, mHeight);
+    for (size_t i = 0; i < mCounts.size(); i++)
+    {
+        float scale = (mCounts[i] > 0) ? 1.0f / mCounts[i] : 0.0f;
+        for (int c = 0; c < 3; c++)
+        {
+            hdr.mPixels[i * 3 + c] = mSums[i * 3 + c] * scale;
+        }
+    }
+    return hdr;
+}
+
+void SampleBuffer::write(std::ostream &out) const
+{
+    int32_t header[4] = {(int32_t)sMagic, (int32_t)sVersion, mWidth, mHeight};
+    out.write((const char *)header, sizeof(header));
+    out.write((const char *)mSums.data(), mSums.size() * sizeof(float));
+    out.write((const char *)mCounts.data(), mCounts.size() * sizeof(uint32_t));
+    out.write((const char *)mLuminance.data(), mLuminance.size() * sizeof(double));
+}
+
+void SampleBuffer::read(std::istream &in)
+{
+    int32_t header[4];
+    in.read((char *)header, sizeof(header));
+    if (!in || (uint32_t)header[0] != sMagic || (uint32_t)header[1] != sVersion)
+    {
+        throw std::invalid_argument("Not a sample buffer, or from a different version");
+    }
+    if (header[2] < 0 || header[3] < 0)
+    {
+        throw std::invalid_argument("Invalid sample buffer size");
+    }
+    *this = SampleBuffer(header[2], header[3]);
+    in.read((char *)mSums.data(), mSums.size() * sizeof(float));
+    in.read((char *)mCounts.data(), mCounts.size() * sizeof(uint32_t));
+    in.read((char *)mLuminance.data(), mLuminance.size() * sizeof(double));
+    if (!in)
+    {
+        throw std::invalid_argument("Sample buffer is truncated");
+    }
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <vector>
+#include "color.hpp"
+#include "hdrImage.hpp"
+
+/**
+ * @brief Running sums of every sample rendered for each pixel of an
+ * image. Buffers from different renders of the same image (different
+ * seeds, tiles, or machines) can be added together.
+ */
+class SampleBuffer
+{
+public:
+    int mWidth, mHeight;
+    std::vector<float> mSums;       // RGB sum of every sample
+    std::vector<uint32_t> mCounts;  // Samples per pixel
+    std::vector<double> mLuminance; // Sum and sum of squares of clipped sample luminance
+
+    SampleBuffer();
+    SampleBuffer(int width, int height);
+
+    /**
+     * @brief Add a sample to a pixel. Pixels are independent, so
+     * threads can add to different pixels without locking.
+     *
+     * @param index y * mWidth + x
+     */
+    inline void add(int index, const Color &color)
+    {
+        // Round the sample to float before adding, so the sums come out
+        // the same when tiles are rendered into separate buffers and merged
+        float *sum = &mSums[index * 3];
+        sum[0] += (float)color[0];
+        sum[1] += (float)color[1];
+        sum[2] += (float)color[2];
+        mCounts[index]++;
+
+        Color clipped = color;
+        clipped.vclip(1.0);
+        double luminance = 0.2126 * clipped[0] + 0.7152 * clipped[1] + 0.0722 * clipped[2];
+        mLuminance[index * 2] += luminance;
+        mLuminance[index * 2 + 1] += luminance * luminance;
+    }
+
+    /**
+     * @brief Add every sample of another buffer to a rectangle of this
+     * one, e.g. a tile rendered elsewhere or a whole render made with
+     * a different seed. Throws std::invalid_argument if it doesn't fit.
+     *
+     * @param x, y Where the top left pixel of other goes
+     */
+    void merge(const SampleBuffer &other, int x = 0, int y = 0);
+
+    /**
+     * @brief Copy out a rectangle of the buffer.
+     */
+    SampleBuffer crop(int x, int y, int width, int height) const;
+
+    /**
+     * @brief Overwrite a rectangle of the buffer with a smaller
+     * buffer, e.g. one returned by crop().
+     */
+    void paste(const SampleBuffer &other, int x, int y);
+
+    /**
+     * @brief Average the samples of every pixel.
+     */
+    HdrImage average() const;
+
+    /**
+     * @brief Serialize the buffer. The format is in host byte order.
+     */
+    void write(std::ostream &out) const;
+
+    /**
+     * @brief Deserialize a buffer written by write(). Throws
+     * std::invalid_argument if it's not a valid buffer.
+     */
+    void read(std::istream &in);
+};
@@ -0,0 +1,225 @@
+#include "sampler.hpp"
+#include "random.hpp"
+#include "common.hpp"
+
+#include <cmath>
+#include <stdexcept>
+
+static inline uint32_t reverseBits(uint32_t x)
+{
+    x = (x << 16) | (x >> 16);
+    x = ((x & 0x00ff00ff) << 8) | ((x & 0xff00ff00) >> 8);
+    x = ((x & 0x0f0f0f0f) << 4) | ((x & 0xf0f0f0f0) >> 4);
+    x = ((x & 0x33333333) << 2) | ((x & 0xcccccccc) >> 2);
+    x = ((x & 0x55555555) << 1) | ((x & 0xaaaaaaaa) >> 1);
+    return x;
+}
+
+/**
+ * @brief Owen scramble a 32 bit fixed point number: flip each binary
+ * digit based on the digits before it. Uses the hash based nested
+ * uniform scramble from Burley, "Practical Hash-based Owen Scrambling",
+ * 2020.
+ */
+static inline uint32_t owenScramble(uint32_t x, uint32_t seed)
+{
+    // Laine and Karras' permutation only mixes bits upwards, so do it on
+    // the reversed digits
+    x = reverseBits(x);
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return reverseBits(x);
+}
+
+/**
+ * @brief Point index of the first two Sobol dimensions (the (0, 2)
+ * sequence), as 32 bit fixed point.
+ */
+static inline void sobol2D(uint32_t index, uint32_t &x, uint32_t &y)
+{
+    // The first dimension is the van der Corput sequence, the second
+    // has direction numbers v[i + 1] = v[i] ^ (v[i] >> 1)
+    x = reverseBits(index);
+    y = 0;
+    for (uint32_t v = 1u << 31; index; index >>= 1, v ^= v >> 1)
+    {
+        if (index & 1)
+        {
+            y ^= v;
+        }
+    }
+}
+
+static inline double toUnit(uint32_t x)
+{
+    return x * (1.0 / 4294967296.0);
+}
+
+Sampler::Sampler(enum Type type, int width) : mType(type), mWidth(width)
+{
+    if (mType == BLUE_NOISE)
+    {
+        mBlueNoise = makeBlueNoise();
+    }
+}
+
+enum Sampler::Type Sampler::stringToType(std::string str)
+{
+    if (str == "random")
+    {
+        return RANDOM;
+    }
+    if (str == "sobol")
+    {
+        return SOBOL;
+    }
+    if (str == "bluenoise")
+    {
+        return BLUE_NOISE;
+    }
+    throw std::invalid_argument("Invalid sampler");
+}
+
+void Sampler::get2D(uint64_t seed, int pixel, uint32_t sample, int dimension, double &u, double &v) const
+{
+    if (mType == RANDOM)
+    {
+        u = randomDouble();
+        v = randomDouble();
+        return;
+    }
+
+    // Every dimension pair gets its own scrambling, and its own shuffle
+    // of the sample order so the pairs aren't correlated with each other.
+    // The shuffle only swaps samples within aligned power of two blocks,
+    // so every 2^k samples are still stratified.
+    uint64_t key = Pcg32::hash(seed ^ Pcg32::hash(dimension));
+    if (mType == SOBOL)
+    {
+        key = Pcg32::hash(key ^ (uint64_t)pixel);
+    }
+    uint32_t x, y;
+    sobol2D(owenScramble(sample, (uint32_t)key), x, y);
+    u = toUnit(owenScramble(x, (uint32_t)(key >> 32)));
+    v = toUnit(owenScramble(y, (uint32_t)Pcg32::hash(key)));
+
+    if (mType == BLUE_NOISE)
+    {
+        // Every pixel shares the sequence, shifted (toroidally) by its
+        // blue noise value, so neighbouring pixels' errors cancel out.
+        // Each number reads the tile at its own offset.
+        uint64_t offsets = Pcg32::hash(key);
+        int px = pixel % mWidth, py = pixel / mWidth;
+        for (int i = 0; i < 2; i++)
+        {
+            int ox = (px + (int)((offsets >> (32 * i)) % sBlueNoiseSize)) % sBlueNoiseSize;
+            int oy = (py + (int)((offsets >> (32 * i + 16)) % sBlueNoiseSize)) % sBlueNoiseSize;
+            double &value = i == 0 ? u : v;
+            value += mBlueNoise[oy * sBlueNoiseSize + ox];
+            value -= (value >= 1.0) ? 1.0 : 0.0;
+        }
+    }
+}
+
+std::vector<float> Sampler::makeBlueNoise()
+{
+    const int size = sBlueNoiseSize;
+    const int count = size * size;
+    const double sigma = 1.5;
+
+    // Energy a point adds at each (wrapped around) offset from it.
+    // A pixel's energy is high when points are crowded around it.
+    std::vector<float> kernel(count);
+    for (int y = 0; y < size; y++)
+    {
+        for (int x = 0; x < size; x++)
+        {
+            int dx = MIN(x, size - x), dy = MIN(y, size - y);
+            kernel[y * size + x] = std::exp(-(dx * dx + dy * dy) / (2 * sigma * sigma));
+        }
+    }
+    std::vector<uint8_t> pattern(count, 0);
+    std::vector<float> energy(count, 0.0f);
+    auto toggle = [&](int p, bool set)
+    {
+        pattern[p] = set;
+        float sign = set ? 1.0f : -1.0f;
+        int px = p % size, py = p / size;
+        for (int y = 0; y < size; y++)
+        {
+            for (int x = 0; x < size; x++)
+            {
+                energy[y * size + x] += sign * kernel[((y - py) & (size - 1)) * size + ((x - px) & (size - 1))];
+            }
+        }
+    };
+    // Most crowded point, or emptiest pixel without a point
+    auto find = [&](bool tightestCluster)
+    {
+        int best = -1;
+        for (int p = 0; p < count; p++)
+        {
+            if (pattern[p] == tightestCluster &&
+                (best < 0 || (tightestCluster ? energy[p] > energy[best] : energy[p] < energy[best])))
+            {
+                best = p;
+            }
+        }
+        return best;
+    };
+
+    // Start from a tenth of the pixels at random, and move the most
+    // crowded point to the biggest gap until that stops changing anything
+    Pcg32 random;
+    int initial = count / 10;
+    for (int placed = 0; placed < initial;)
+    {
+        int p = random.next() % count;
+        if (!pattern[p])
+        {
+            toggle(p, true);
+            placed++;
+        }
+    }
+    for (int i = 0; i < count; i++)
+    {
+        int cluster = find(true);
+        toggle(cluster, false);
+        int gap = find(false);
+        toggle(gap, true);
+        if (gap == cluster)
+        {
+            break;
+        }
+    }
+
+    // Rank the starting points by taking out the most crowded one each
+    // time, then the rest by filling the biggest gap each time. Ulichney
+    // ranks the second half by the clusters of empty pixels instead,
+    // but with a Gaussian those are the same gaps.
+    std::vector<uint8_t> startPattern = pattern;
+    std::vector<float> startEnergy = energy;
+    std::vector<float> rank(count);
+    for (int r = initial - 1; r >= 0; r--)
+    {
+        int cluster = find(true);
+        toggle(cluster, false);
+        rank[cluster] = r;
+    }
+    pattern = startPattern;
+    energy = startEnergy;
+    for (int r = initial; r < count; r++)
+    {
+        int gap = find(false);
+        toggle(gap, true);
+        rank[gap] = r;
+    }
+    for (float &r : rank)
+    {
+        r = (r + 0.5f) / count;
+    }
+    return rank;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Where the renderer gets the random numbers for the sample
+ * dimensions that matter most: the point in the pixel, the point on the
+ * lens, and the direction of each diffuse bounce. Each is a pair of
+ * numbers, uniform in [0, 1)^2, looked up by pixel, sample index and
+ * dimension, so a sample is the same whichever thread asks for it.
+ *
+ * Everything else (light picks, roulette, volumes) keeps drawing from
+ * randGen.
+ */
+class Sampler
+{
+public:
+    enum Type
+    {
+        RANDOM = 0, // Independent random numbers from randGen
+        SOBOL,      // Owen scrambled Sobol (0, 2)-sequence, scrambled differently for every pixel
+        BLUE_NOISE, // One scrambled Sobol sequence, offset in every pixel by a blue noise tile
+    };
+
+    // Dimension pairs. Bounce j of a path uses sBounceDimension + j.
+    static constexpr int sPixelDimension = 0;
+    static constexpr int sLensDimension = 1;
+    static constexpr int sBounceDimension = 2;
+
+    static constexpr int sBlueNoiseSize = 64; // Width and height of the blue noise tile
+
+    /**
+     * @param width Image width, to find a pixel's place in the blue
+     * noise tile
+     */
+    Sampler(enum Type type = RANDOM, int width = 0);
+
+    /**
+     * @brief Convert a string ("random", "sobol", "bluenoise") to a sampler type.
+     */
+    static enum Type stringToType(std::string str);
+
+    inline enum Type type() const
+    {
+        return mType;
+    }
+
+    /**
+     * @brief Get one dimension pair of a sample. Samples 0 to 2^k - 1 of
+     * a pixel are stratified for every k, so the Sobol samplers work
+     * best with power of two sample counts. The random sampler draws
+     * from randGen, so call it in the same order every time.
+     *
+     * @param seed Render seed, picks the scrambling
+     * @param pixel Index of the pixel, y * width + x
+     * @param sample Index of the sample in the pixel, counting every pass
+     * @param dimension Which pair of numbers
+     */
+    void get2D(uint64_t seed, int pixel, uint32_t sample, int dimension, double &u, double &v) const;
+
+private:
+    enum Type mType;
+    int mWidth;
+    std::vector<float> mBlueNoise; // Rank of each texel in the blue noise tile, in (0, 1)
+
+    /**
+     * @brief Make a blue noise tile with void and cluster (Ulichney,
+     * "The void-and-cluster method for dither array generation", 1993).
+     * Pixels are ranked by repeatedly filling the largest gap in the
+     * pattern so far, so thresholding the tile at any level gives evenly
+     * spread points.
+     */
+    static std::vector<float> makeBlueNoise();
+};
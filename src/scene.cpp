@@ -3,10 +3,14 @@
 #include <string>
 #include <iostream>
 #include <algorithm>
+#include <limits>
+#include <map>
 #include "vector.hpp"
 #include "scene.hpp"
 #include "color.hpp"
 #include "common.hpp"
+#include "mesh.hpp"
+#include "triangleBuffer.hpp"
 
 namespace object
 {
@@ -19,6 +23,47 @@ namespace object
         return BoundingBox();
     }
 
+    double Primitive::area() const
+    {
+        return 0;
+    }
+
+    void Primitive::samplePoint(Vector &point, Vector &normal) const
+    {
+        (void)point;
+        (void)normal;
+        throw std::logic_error("Primitive can't be sampled");
+    }
+
+    bool Primitive::sampleLight(const Vector &from, Vector &dir, double &pdf) const
+    {
+        Vector point, normal;
+        samplePoint(point, normal);
+        dir = Vector::svsub(point, from);
+        double distance = sqrt(Vector::dot(dir, dir));
+        if (CLOSE_TO(distance, 0.0))
+        {
+            return false;
+        }
+        dir.vscale(1.0 / distance);
+        pdf = lightPdf(from, point, normal);
+        return pdf > 0;
+    }
+
+    double Primitive::lightPdf(const Vector &from, const Vector &point, const Vector &normal) const
+    {
+        // Convert the uniform pdf over the area to a pdf over solid angle:
+        // a patch dA at distance d, tilted by theta, covers dA * cos(theta) / d^2
+        Vector toPoint = Vector::svsub(point, from);
+        double distanceSquared = Vector::dot(toPoint, toPoint);
+        double cosTheta = std::abs(Vector::dot(normal, toPoint)) / sqrt(distanceSquared);
+        if (CLOSE_TO(cosTheta, 0.0))
+        {
+            return 0;
+        }
+        return distanceSquared / (area() * cosTheta);
+    }
+
     void Primitive::textureLookup(const Vector &intersection, double u, double v, Color &color) const
     {
         color = mTexture ? mTexture->getUv(u, v) : mColor;
@@ -34,6 +79,9 @@ namespace object
 
     enum Primitive::Collision Primitive::bounce(Ray &incoming, const Vector &intersection, const Vector &normal) const
     {
+        incoming.mBouncePrimitive = this;
+        incoming.mBounceSurface = mSurface;
+        incoming.mBounceNormal = normal;
         switch (mSurface)
         {
         case Color::SPECULAR:
@@ -66,7 +114,9 @@ namespace object
     {
         // Reflect 1 ray with a Lambertian reflection
         incoming.mOrigin = intersection;
-        Vector scatterDirection = Vector::svadd(normal, Vector::svrand3());
+        // normal + a uniform point on the unit sphere is cosine distributed,
+        // the renderer relies on that pdf for light sampling
+        Vector scatterDirection = Vector::svadd(normal, Vector::svsphere3(incoming.mScatterSample[0], incoming.mScatterSample[1]));
         if (scatterDirection.closeToZero())
         {
             incoming.mDir = normal;
@@ -153,50 +203,18 @@ namespace object
         mNormal.vnorm();
     }
 
-    enum Primitive::Collision Triangle::collide(Ray &incoming, double &t, Color &color) const
+    bool Triangle::intersect(const Ray &incoming, Hit &hit) const
     {
-        // Check ray-plane intersection
-        double dirDotNorm = Vector::dot(incoming.mDir, mNormal);
-        if (CLOSE_TO(dirDotNorm, 0.0))
-        {
-            // Incoming is parallel
-            return Collision::MISSED;
-        }
-
-        t = Vector::svsub(mVertices[0], incoming.mOrigin).dot(mNormal) / dirDotNorm;
-        if (t < 0)
-        {
-            // Don't hit things behind us
-            return Collision::MISSED;
-        }
-        else if (CLOSE_TO(t, 0.0))
-        {
-            // Don't collide with an object we just collided with
-            return Collision::MISSED;
-        }
-
-        Vector intersection = Vector::svadd(incoming.mOrigin, Vector::svscale(incoming.mDir, t));
-
-        Vector v0 = Vector::svsub(mVertices[1], mVertices[0]);
-        Vector v1 = Vector::svsub(mVertices[2], mVertices[0]);
-        Vector v2 = Vector::svsub(intersection, mVertices[0]);
-
-        float d00 = Vector::dot(v0, v0);
-        float d01 = Vector::dot(v0, v1);
-        float d11 = Vector::dot(v1, v1);
-        float d20 = Vector::dot(v2, v0);
-        float d21 = Vector::dot(v2, v1);
-        float denom = d00 * d11 - d01 * d01;
-        double beta = (d11 * d20 - d01 * d21) / denom;
-        double gamma = (d00 * d21 - d01 * d20) / denom;
-        double alpha = 1.0f - beta - gamma;
-
-        if (alpha < 0.0 || beta < 0.0 || gamma < 0.0)
-        {
-            // Did not intersect
-            return Collision::MISSED;
-        }
+        double alpha;
+        return intersect(incoming, hit.mT, alpha, hit.mU, hit.mV);
+    }
 
+    enum Primitive::Collision Triangle::shade(const Hit &hit, Ray &incoming, Color &color) const
+    {
+        double beta = hit.mU;
+        double gamma = hit.mV;
+        double alpha = 1.0 - beta - gamma;
+        Vector intersection = Vector::svadd(incoming.mOrigin, Vector::svscale(incoming.mDir, hit.mT));
         if (mSurface == Color::SPECULAR || mSurface == Color::DIELECTRIC)
         {
             color = Color(1, 1, 1);
@@ -210,6 +228,17 @@ namespace object
         return bounce(incoming, intersection, mNormal);
     }
 
+    bool Triangle::intersect(const Ray &incoming, double &t, double &alpha, double &beta, double &gamma) const
+    {
+        // Watertight, so rays can't slip between triangles that share an edge
+        if (!WatertightRay(incoming).intersect(mVertices, t, beta, gamma))
+        {
+            return false;
+        }
+        alpha = 1.0 - beta - gamma;
+        return true;
+    }
+
     BoundingBox Triangle::boundingBox() const
     {
         double minX = MIN(MIN(mVertices[0][V_X], mVertices[1][V_X]), mVertices[2][V_X]);
@@ -221,6 +250,27 @@ namespace object
         return BoundingBox(minX, maxX, minY, maxY, minZ, maxZ);
     }
 
+    double Triangle::area() const
+    {
+        Vector edgeCross = Vector::scross3(Vector::svsub(mVertices[1], mVertices[0]), Vector::svsub(mVertices[2], mVertices[0]));
+        return 0.5 * sqrt(Vector::dot(edgeCross, edgeCross));
+    }
+
+    void Triangle::samplePoint(Vector &point, Vector &normal) const
+    {
+        // Uniform barycentric coordinates, see Shirley's "Sampling
+        // Transformations Zoo"
+        double sqrtU = sqrt(randomDouble());
+        double v = randomDouble();
+        double alpha = 1.0 - sqrtU;
+        double beta = sqrtU * (1.0 - v);
+        double gamma = sqrtU * v;
+        point = Vector::svscale(mVertices[0], alpha);
+        point.vadd(Vector::svscale(mVertices[1], beta));
+        point.vadd(Vector::svscale(mVertices[2], gamma));
+        normal = mNormal;
+    }
+
     void Triangle::textureLookup(double alpha, double beta, double gamma, const Vector &intersection, Color &color) const
     {
         // Thanks stack overflow https://stackoverflow.com/questions/17164376/inferring-u-v-for-a-point-in-a-triangle-from-vertex-u-vs
@@ -270,7 +320,7 @@ namespace object
         mPerlin = NULL;
     }
 
-    enum Primitive::Collision Quadric::collide(Ray &incoming, double &t, Color &color) const
+    bool Quadric::intersect(const Ray &incoming, Hit &hit) const
     {
         // a2, b2, c2, d2 are the squared and signed versions of a, b, c, d in the
         // hyperboloid equation. Reorganize (Cx - X)^2/a2 + (Cy - Y)^2/b2 + (Cz - Z)^2/c2 = d2
@@ -297,11 +347,11 @@ namespace object
         if (discriminant < 0.0)
         {
             // No real roots
-            return Collision::MISSED;
+            return false;
         }
 
         // Take the negative of the +/-, we want the smaller t (closer point)
-        t = (-b - sqrt(discriminant)) / (2.0 * a);
+        double t = (-b - sqrt(discriminant)) / (2.0 * a);
         if (mSurface == Color::Surface::DIELECTRIC && CLOSE_TO(std::abs(t), 0.0))
         {
             // Dielectrics change ray direction at the surface of
@@ -314,12 +364,12 @@ namespace object
         if (t < 0)
         {
             // Don't hit things behind us
-            return Collision::MISSED;
+            return false;
         }
         else if (CLOSE_TO(t, 0.0))
         {
             // Don't collide with an object we just collided with
-            return Collision::MISSED;
+            return false;
         }
 
         Vector intersection = Vector::svadd(incoming.mOrigin, Vector::svscale(incoming.mDir, t));
@@ -327,17 +377,25 @@ namespace object
         // Ignore the reflection of the quadric over the origin plane (plane normal to mAxis)
         if (mAxis == "x" && intersection[0] < mOrigin[0])
         {
-            return Collision::MISSED;
+            return false;
         }
         if (mAxis == "y" && intersection[1] < mOrigin[1])
         {
-            return Collision::MISSED;
+            return false;
         }
         if (mAxis == "z" && intersection[2] < mOrigin[2])
         {
-            return Collision::MISSED;
+            return false;
         }
 
+        hit.mT = t;
+        return true;
+    }
+
+    enum Primitive::Collision Quadric::shade(const Hit &hit, Ray &incoming, Color &color) const
+    {
+        Vector intersection = Vector::svadd(incoming.mOrigin, Vector::svscale(incoming.mDir, hit.mT));
+
         // Calculate surface normal using the gradient at the intersection point
         // gradient = <dF/dx, dF/dy, dF/dz> for those who forgot (those are all partial derivatives).
         // Conveniently, all quadrics have x^2 terms so it's just a matter of multiplying in
@@ -419,7 +477,7 @@ namespace object
         mPerlin = NULL;
     }
 
-    enum Primitive::Collision Sphere::collide(Ray &incoming, double &t, Color &color) const
+    bool Sphere::intersect(const Ray &incoming, Hit &hit) const
     {
         // The math for this is really complicated, it's basically
         // solving a quadratic equation. See Ray Tracing in One Weekend
@@ -428,10 +486,11 @@ namespace object
         double b = -2.0 * Vector::dot(incoming.mDir, centerMinusIncoming);
         double c = Vector::dot(centerMinusIncoming, centerMinusIncoming) - mRadius * mRadius;
         double discriminant = b * b - 4.0 * a * c;
+        double t;
         if (discriminant < 0)
         {
             // No intersection
-            return Collision::MISSED;
+            return false;
         }
         else
         {
@@ -449,16 +508,22 @@ namespace object
             if (t < 0)
             {
                 // Don't hit things behind us
-                return Collision::MISSED;
+                return false;
             }
             else if (CLOSE_TO(t, 0.0))
             {
                 // Don't collide with an object we just collided with
-                return Collision::MISSED;
+                return false;
             }
         }
 
-        Vector intersection = Vector::svadd(incoming.mOrigin, Vector::svscale(incoming.mDir, t));
+        hit.mT = t;
+        return true;
+    }
+
+    enum Primitive::Collision Sphere::shade(const Hit &hit, Ray &incoming, Color &color) const
+    {
+        Vector intersection = Vector::svadd(incoming.mOrigin, Vector::svscale(incoming.mDir, hit.mT));
         Vector normal = Vector::svscale(Vector::svsub(intersection, mOrigin), 1.0 / mRadius);
         if (mSurface == Color::SPECULAR || mSurface == Color::DIELECTRIC)
         {
@@ -484,6 +549,54 @@ namespace object
             mOrigin[V_Z] + mRadius);
     }
 
+    double Sphere::area() const
+    {
+        return 4.0 * M_PI * mRadius * mRadius;
+    }
+
+    bool Sphere::sampleLight(const Vector &from, Vector &dir, double &pdf) const
+    {
+        // Pick a direction in the cone from the lit point that just
+        // contains the sphere. Uniform over solid angle.
+        Vector toCenter = Vector::svsub(mOrigin, from);
+        double distanceSquared = Vector::dot(toCenter, toCenter);
+        if (distanceSquared <= mRadius * mRadius)
+        {
+            // Inside the sphere
+            return false;
+        }
+        double cosThetaMax = sqrt(1.0 - mRadius * mRadius / distanceSquared);
+        double cosTheta = 1.0 - randomDouble() * (1.0 - cosThetaMax);
+        double sinTheta = sqrt(MAX(1.0 - cosTheta * cosTheta, 0.0));
+        double phi = 2.0 * M_PI * randomDouble();
+
+        // Orthonormal basis around the cone axis
+        Vector w = Vector::svscale(toCenter, 1.0 / sqrt(distanceSquared));
+        Vector a = (std::abs(w[V_X]) > 0.9) ? Vector(0, 1, 0) : Vector(1, 0, 0);
+        Vector u = Vector::scross3(a, w).vnorm();
+        Vector v = Vector::scross3(w, u);
+
+        dir = Vector::svscale(u, cos(phi) * sinTheta);
+        dir.vadd(Vector::svscale(v, sin(phi) * sinTheta));
+        dir.vadd(Vector::svscale(w, cosTheta));
+        pdf = 1.0 / (2.0 * M_PI * (1.0 - cosThetaMax));
+        return true;
+    }
+
+    double Sphere::lightPdf(const Vector &from, const Vector &point, const Vector &normal) const
+    {
+        (void)point;
+        (void)normal;
+        Vector toCenter = Vector::svsub(mOrigin, from);
+        double distanceSquared = Vector::dot(toCenter, toCenter);
+        if (distanceSquared <= mRadius * mRadius)
+        {
+            return 0;
+        }
+        double cosThetaMax = sqrt(1.0 - mRadius * mRadius / distanceSquared);
+        return 1.0 / (2.0 * M_PI * (1.0 - cosThetaMax));
+    }
+
     void Sphere::textureLookup(Vector &intersection, Color &color) const
     {
         // Convert intersection point to spherical coordinates
@@ -535,26 +648,26 @@ namespace object
         mW = Vector::svscale(widthCrossHeight, 1.0 / Vector::dot(widthCrossHeight, widthCrossHeight));
     }
 
-    enum Primitive::Collision Quad::collide(Ray &incoming, double &t, Color &color) const
+    bool Quad::intersect(const Ray &incoming, Hit &hit) const
     {
         // Check ray-plane intersection
         double dirDotNorm = Vector::dot(incoming.mDir, mNormal);
         if (CLOSE_TO(dirDotNorm, 0.0))
         {
             // Incoming is parallel
-            return Collision::MISSED;
+            return false;
         }
 
-        t = Vector::dot(Vector::svsub(mOrigin, incoming.mOrigin), mNormal) / dirDotNorm;
+        double t = Vector::dot(Vector::svsub(mOrigin, incoming.mOrigin), mNormal) / dirDotNorm;
         if (t < 0)
         {
             // Don't hit things behind us
-            return Collision::MISSED;
+            return false;
         }
         else if (CLOSE_TO(t, 0.0))
         {
             // Don't collide with an object we just collided with
-            return Collision::MISSED;
+            return false;
         }
 
         Vector intersection = Vector::svadd(incoming.mOrigin, Vector::svscale(incoming.mDir, t));
@@ -566,16 +679,25 @@ namespace object
         // If alpha and beta are [0.0, 1.0], then the intersection is inside the quad.
         if (!IN_RANGE(alpha, 0.0, 1.0) || !IN_RANGE(beta, 0.0, 1.0))
         {
-            return Collision::MISSED;
+            return false;
         }
 
+        hit.mT = t;
+        hit.mU = alpha;
+        hit.mV = beta;
+        return true;
+    }
+
+    enum Primitive::Collision Quad::shade(const Hit &hit, Ray &incoming, Color &color) const
+    {
+        Vector intersection = Vector::svadd(incoming.mOrigin, Vector::svscale(incoming.mDir, hit.mT));
         if (mSurface == Color::SPECULAR || mSurface == Color::DIELECTRIC)
         {
             color = Color(1, 1, 1);
         }
         else
         {
-            textureLookup(alpha, beta, intersection, color);
+            textureLookup(hit.mU, hit.mV, intersection, color);
         }
 
         // Bounce it
@@ -597,6 +719,19 @@ namespace object
         return BoundingBox(minX, maxX, minY, maxY, minZ, maxZ);
     }
 
+    double Quad::area() const
+    {
+        Vector widthCrossHeight = Vector::scross3(mWidth, mHeight);
+        return sqrt(Vector::dot(widthCrossHeight, widthCrossHeight));
+    }
+
+    void Quad::samplePoint(Vector &point, Vector &normal) const
+    {
+        point = Vector::svadd(mOrigin, Vector::svscale(mWidth, randomDouble()));
+        point.vadd(Vector::svscale(mHeight, randomDouble()));
+        normal = mNormal;
+    }
+
     void Quad::textureLookup(double alpha, double beta, const Vector &intersection, Color &color) const
     {
         // Intersection testing gives us alpha and beta, which are
@@ -604,16 +739,31 @@ namespace object
         Primitive::textureLookup(intersection, alpha, beta, color);
     }
 
-    Model::Model(tinyobj::ObjReader &obj, const Vector &origin, const Vector &front, const Vector &top, const Vector &scale, enum Color::Surface surface, double indexOfRefraction, const Color &color) : mObj(obj)
+    Model::Model(const Mesh &mesh, const Vector &origin, const Vector &front, const Vector &top, const Vector &scale, enum Color::Surface surface, double indexOfRefraction, const Color &color) : mMesh(mesh)
     {
         mModelMatrix = ModelMatrix(origin, Vector::svnorm(front), Vector::svnorm(top), scale);
+        mBaked = NULL;
         mSurface = surface;
         mIndexOfRefraction = indexOfRefraction;
         mColor = color;
+        mTexture = NULL;
+        mPerlin = NULL;
+        mBoundingBox = boundingBox();
+    }
+
+    Model::Model(const Mesh &mesh, const ModelMatrix &modelMatrix, enum Color::Surface surface, double indexOfRefraction, const Color &color) : mMesh(mesh)
+    {
+        mModelMatrix = modelMatrix;
+        mBaked = NULL;
+        mSurface = surface;
+        mIndexOfRefraction = indexOfRefraction;
+        mColor = color;
+        mTexture = NULL;
+        mPerlin = NULL;
         mBoundingBox = boundingBox();
     }
 
-    Model::Model(nlohmann::json &json, tinyobj::ObjReader &obj) : mObj(obj)
+    Model::Model(nlohmann::json &json, const Mesh &mesh) : mMesh(mesh)
     {
         mModelMatrix = ModelMatrix(
             Vector(json["origin"]["x"],
@@ -630,72 +780,63 @@ namespace object
             Vector(json["scale"]["x"],
                    json["scale"]["y"],
                    json["scale"]["z"]));
+        mBaked = NULL;
+        mTexture = NULL;
+        mPerlin = NULL;
     }
 
-    enum Primitive::Collision Model::collide(Ray &incoming, double &t, Color &color) const
-    {
-        Triangle tri = Triangle();
-        tri.mSurface = mSurface;
-        tri.mIndexOfRefraction = mIndexOfRefraction;
-        tri.mColor = mColor;
-        tri.mTexture = NULL;
-        tri.mPerlin = NULL;
-
-        Ray closestRay;
-        t = std::numeric_limits<double>::infinity();
-        Collision closestCollision = Collision::MISSED;
-        Ray thisRay = Ray(incoming);
-        double thisT;
-        Color thisColor;
-        Collision thisCollision;
-
-        // Essentially rewrite the main render loop but for only this model
-        auto &attrib = mObj.GetAttrib();
-        auto &shapes = mObj.GetShapes();
-        auto &materials = mObj.GetMaterials();
-        int indexOffset = 0;
-        for (size_t s = 0; s < shapes.size(); s++)
-        {
-            const tinyobj::shape_t &shape = shapes[s];
-            size_t numTriangles = shape.mesh.num_face_vertices.size();
-            for (size_t n = 0; n < numTriangles; n++)
-            {
-                // Every face is going to be 3 vertices (almost always)
-                // Fill in our triangle
-                for (int i = 0; i < 3; i++)
-                {
-                    // Index buffer lookup
-                    tinyobj::index_t index = shape.mesh.indices[indexOffset + i];
-                    // Vertex buffer lookup
-                    for (int j = 0; j < 3; j++)
-                    {
-                        tri.mVertices[i].v[j] = attrib.vertices[3 * size_t(index.vertex_index) + j];
-                    }
-
-                    // Handle scaling, rotation, and positioning (model matrix).
-                    // Do on the fly so we can do proper object instancing (vertex shader-style)
-                    mModelMatrix.mul(tri.mVertices[i]);
-                }
-                // Fill in surface normal assuming CCW winding order (standard for OBJ and OpenGL)
-                tri.mNormal.cross3(Vector::svsub(tri.mVertices[1], tri.mVertices[0]), Vector::svsub(tri.mVertices[2], tri.mVertices[1]));
-                tri.mNormal.vnorm();
+    bool Model::intersect(const Ray &incoming, Hit &hit) const
+    {
+        if (mBaked)
+        {
+            return mBaked->intersect(incoming, hit);
+        }
 
-                thisCollision = tri.collide(thisRay, thisT, thisColor);
-                if (thisCollision != Collision::MISSED && thisT < t)
-                {
-                    // Found a closer collision
-                    closestRay = Ray(thisRay);
-                    t = thisT;
-                    color = Color(thisColor);
-                    closestCollision = thisCollision;
-                }
-                indexOffset += 3;
+        // Move the ray into object space instead of moving every triangle
+        // into world space. The direction isn't renormalized, so t is the
+        // same in both spaces.
+        Ray objectRay;
+        objectRay.mOrigin = incoming.mOrigin;
+        objectRay.mDir = incoming.mDir;
+        mModelMatrix.mulInverse(objectRay.mOrigin);
+        mModelMatrix.mulInverseDirection(objectRay.mDir);
+
+        return mMesh.intersect(objectRay, hit);
+    }
+
+    enum Primitive::Collision Model::shade(const Hit &hit, Ray &incoming, Color &color) const
+    {
+        // Only the closest triangle gets moved into world space and shaded.
+        // Handle scaling, rotation, and positioning (model matrix). Baked
+        // hits use the same triangle, so they shade like instanced ones.
+        const Triangle &tri = mMesh.mTriangles[hit.mTriangle];
+        Vector vertices[3];
+        for (int i = 0; i < 3; i++)
+        {
+            vertices[i] = tri.mVertices[i];
+            mModelMatrix.mul(vertices[i]);
+        }
+        // Fill in surface normal assuming CCW winding order (standard for OBJ and OpenGL)
+        Vector normal = Vector::scross3(Vector::svsub(vertices[1], vertices[0]), Vector::svsub(vertices[2], vertices[1]));
+        normal.vnorm();
+
+        Vector intersection = Vector::svadd(incoming.mOrigin, Vector::svscale(incoming.mDir, hit.mT));
+        if (mSurface == Color::SPECULAR || mSurface == Color::DIELECTRIC)
+        {
+            color = Color(1, 1, 1);
+        }
+        else
+        {
+            // No texture lookup support
+            color = mColor;
+            if (mSurface == Color::Surface::EMISSIVE)
+            {
+                color.vscale(sEmissiveGain);
             }
         }
 
-        incoming = Ray(closestRay);
-        // t, color set during execution
-        return closestCollision;
+        // Bounce it
+        return bounce(incoming, intersection, normal);
     }
 
     BoundingBox Model::boundingBox() const
@@ -708,44 +849,26 @@ namespace object
         double minZ = std::numeric_limits<double>::infinity();
         double maxZ = -std::numeric_limits<double>::infinity();
 
-        auto &attrib = mObj.GetAttrib();
-        auto &shapes = mObj.GetShapes();
-        auto &materials = mObj.GetMaterials();
-        int indexOffset = 0;
-        for (size_t s = 0; s < shapes.size(); s++)
+        for (const Triangle &tri : mMesh.mTriangles)
         {
-            const tinyobj::shape_t &shape = shapes[s];
-            size_t numTriangles = shape.mesh.num_face_vertices.size();
-            for (size_t n = 0; n < numTriangles; n++)
+            for (int i = 0; i < 3; i++)
             {
-                for (int i = 0; i < 3; i++)
-                {
-                    // Index buffer lookup
-                    tinyobj::index_t index = shape.mesh.indices[indexOffset + i];
-                    Vector v;
-                    // Vertex buffer lookup
-                    for (int j = 0; j < 3; j++)
-                    {
-                        v[j] = attrib.vertices[3 * size_t(index.vertex_index) + j];
-                    }
-
-                    // Handle scaling, rotation, and positioning (model matrix).
-                    mModelMatrix.mul(v);
-
-                    if (v[V_X] < minX)
-                        minX = v[V_X];
-                    if (v[V_X] > maxX)
-                        maxX = v[V_X];
-                    if (v[V_Y] < minY)
-                        minY = v[V_Y];
-                    if (v[V_Y] > maxY)
-                        maxY = v[V_Y];
-                    if (v[V_Z] < minZ)
-                        minZ = v[V_Z];
-                    if (v[V_Z] > maxZ)
-                        maxZ = v[V_Z];
-                }
-                indexOffset += 3;
+                // Handle scaling, rotation, and positioning (model matrix).
+                Vector v = tri.mVertices[i];
+                mModelMatrix.mul(v);
+
+                if (v[V_X] < minX)
+                    minX = v[V_X];
+                if (v[V_X] > maxX)
+                    maxX = v[V_X];
+                if (v[V_Y] < minY)
+                    minY = v[V_Y];
+                if (v[V_Y] > maxY)
+                    maxY = v[V_Y];
+                if (v[V_Z] < minZ)
+                    minZ = v[V_Z];
+                if (v[V_Z] > maxZ)
+                    maxZ = v[V_Z];
             }
         }
         return BoundingBox(minX, maxX, minY, maxY, minZ, maxZ);
@@ -761,7 +884,7 @@ namespace object
         mNegInvDensity = -1.0 / (double)(json["density"]);
     }
 
-    enum Primitive::Collision SphereVolume::collide(Ray &incoming, double &t, Color &color) const
+    bool SphereVolume::intersect(const Ray &incoming, Hit &hit) const
     {
         // Find the length of time the ray spends inside of the volume.
         // Stolen from the sphere method -- can't fully reuse, it needs some modifications
@@ -770,10 +893,10 @@ namespace object
         double b = -2.0 * Vector::dot(incoming.mDir, centerMinusIncoming);
         double c = Vector::dot(centerMinusIncoming, centerMinusIncoming) - mRadius * mRadius;
         double discriminant = b * b - 4.0 * a * c;
-        double minT, maxT;
+        double t, minT, maxT;
         if (discriminant < 0)
         {
-            return Collision::MISSED;
+            return false;
         }
         else
         {
@@ -782,11 +905,11 @@ namespace object
 
             if (t < 0)
             {
-                return Collision::MISSED;
+                return false;
             }
             else if (CLOSE_TO(t, 0.0))
             {
-                return Collision::MISSED;
+                return false;
             }
         }
         double timeInVolume = std::abs(maxT - minT);
@@ -795,10 +918,19 @@ namespace object
         double hitTime = mNegInvDensity * log(randomDouble());
         if (hitTime > timeInVolume)
         {
-            return Collision::MISSED;
+            return false;
         }
 
-        Vector intersection = Vector::svadd(incoming.mOrigin, Vector::svscale(incoming.mDir, hitTime));
+        // The ray scatters somewhere inside the volume, but it's still
+        // ordered against other primitives by where it enters
+        hit.mT = t;
+        hit.mU = hitTime;
+        return true;
+    }
+
+    enum Primitive::Collision SphereVolume::shade(const Hit &hit, Ray &incoming, Color &color) const
+    {
+        Vector intersection = Vector::svadd(incoming.mOrigin, Vector::svscale(incoming.mDir, hit.mU));
 
         if (mSurface == Color::SPECULAR || mSurface == Color::DIELECTRIC)
         {
@@ -818,6 +950,11 @@ namespace object
         return Sphere::boundingBox();
     }
 
+    double SphereVolume::area() const
+    {
+        return 0;
+    }
+
     Camera::Camera() {}
 
     Camera::Camera(const Vector &origin, const Vector &front, const Vector &top, double focalLength, double emissiveGain)
@@ -858,12 +995,31 @@ Scene::~Scene()
     }
 }
 
-void Scene::load(std::string sceneJsonPath)
+object::PrimitiveType Scene::stringToType(const std::string &str)
+{
+    static const std::map<std::string, object::PrimitiveType> types = {
+        {"sphere", object::SPHERE},
+        {"sphereVolume", object::SPHERE_VOLUME},
+        {"quadric", object::QUADRIC},
+        {"triangle", object::TRIANGLE},
+        {"quad", object::QUAD},
+        {"obj", object::MODEL},
+    };
+    auto type = types.find(str);
+    if (type == types.end())
+    {
+        throw std::invalid_argument("Invalid object in JSON");
+    }
+    return type->second;
+}
+
+void Scene::load(std::string sceneJsonPath, int jobs)
 {
     std::ifstream f(sceneJsonPath);
 
     using json = nlohmann::json;
     json data = json::parse(f);
+    f.close();
 
     tinyobj::ObjReaderConfig readerConfig;
     readerConfig.mtl_search_path = "./assets/materials"; // Hardcoded, fight me
@@ -872,13 +1028,29 @@ void Scene::load(std::string sceneJsonPath)
 
     // Look at scenes/sample.json for the format
     mCamera = object::Camera(data["camera"]);
+
+    // Size every array up front, mLights holds pointers into them
+    size_t counts[object::NUM_PRIMITIVE_TYPES] = {0};
+    for (json &i : data["objects"])
+    {
+        counts[stringToType(i["type"])]++;
+    }
+    mSpheres.reserve(counts[object::SPHERE]);
+    mSphereVolumes.reserve(counts[object::SPHERE_VOLUME]);
+    mQuadrics.reserve(counts[object::QUADRIC]);
+    mTriangles.reserve(counts[object::TRIANGLE]);
+    mQuads.reserve(counts[object::QUAD]);
+    mModels.reserve(counts[object::MODEL]);
+
     for (json i : data["objects"])
     {
-        if (i["type"] == "obj")
+        object::Primitive *p = NULL;
+        switch (stringToType(i["type"]))
+        {
+        case object::MODEL:
         {
-            // Attributes and vertices are stored in the tinyobj::ObjReader object.
-            // We could spend time deep-copying them out, but that seems foolish.
-            // Just keep the reader around.
+            // Each OBJ file is turned into a Mesh with its own BVH once,
+            // every Model of that file shares it.
 
             // Don't load the same thing multiple times
             size_t fileIndex;
@@ -889,56 +1061,56 @@ void Scene::load(std::string sceneJsonPath)
                     break;
                 }
             }
-            if (fileIndex != mObjFilenames.size())
-            {
-                mPrimitives.push_back(std::make_unique<object::Model>(i, mObjReaders[fileIndex]));
-            }
-            else
+            if (fileIndex == mObjFilenames.size())
             {
-                mObjReaders.push_back(tinyobj::ObjReader());
-                mObjFilenames.push_back(i["path"]);
-                if (!mObjReaders.back().ParseFromFile(i["path"], readerConfig))
+                tinyobj::ObjReader reader;
+                if (!reader.ParseFromFile(i["path"], readerConfig))
                 {
-                    f.close();
                     throw std::invalid_argument("OBJ file parse failed");
                 }
-                mPrimitives.push_back(std::make_unique<object::Model>(i, mObjReaders.back()));
+                mMeshes.push_back(std::make_unique<Mesh>(reader, jobs));
+                mObjFilenames.push_back(i["path"]);
             }
+            mModels.emplace_back(i, *mMeshes[fileIndex]);
+            p = &mModels.back();
+            break;
         }
-        else if (i["type"] == "sphere")
-        {
-            mPrimitives.push_back(std::make_unique<object::Sphere>(i));
-        }
-        else if (i["type"] == "quadric")
-        {
-            mPrimitives.push_back(std::make_unique<object::Quadric>(i));
-        }
-        else if (i["type"] == "triangle")
-        {
-            mPrimitives.push_back(std::make_unique<object::Triangle>(i));
-        }
-        else if (i["type"] == "quad")
-        {
-            mPrimitives.push_back(std::make_unique<object::Quad>(i));
-        }
-        else if (i["type"] == "sphereVolume")
-        {
-            mPrimitives.push_back(std::make_unique<object::SphereVolume>(i));
-        }
-        else
-        {
-            f.close();
+        case object::SPHERE:
+            mSpheres.emplace_back(i);
+            p = &mSpheres.back();
+            break;
+        case object::QUADRIC:
+            mQuadrics.emplace_back(i);
+            p = &mQuadrics.back();
+            break;
+        case object::TRIANGLE:
+            mTriangles.emplace_back(i);
+            p = &mTriangles.back();
+            break;
+        case object::QUAD:
+            mQuads.emplace_back(i);
+            p = &mQuads.back();
+            break;
+        case object::SPHERE_VOLUME:
+            mSphereVolumes.emplace_back(i);
+            p = &mSphereVolumes.back();
+            break;
+        default:
             throw std::invalid_argument("Invalid object in JSON");
         }
 
         // Fill in common attributes
-        auto &p = mPrimitives.back();
         p->mSurface = Color::stringToSurface(i["surface"]);
         p->mBoundingBox = p->boundingBox();
         if (p->mSurface == Color::Surface::DIELECTRIC)
         {
             p->mIndexOfRefraction = i["indexOfRefraction"];
         }
+        if (p->mSurface == Color::Surface::EMISSIVE && p->area() > 0)
+        {
+            p->mIsLight = true;
+            mLights.push_back(p);
+        }
         if (i["perlin"])
         {
             p->mPerlin = &mPerlin;
@@ -973,10 +1145,108 @@ void Scene::load(std::string sceneJsonPath)
         }
     }
 
-    f.close();
-
-    if (mPrimitives.size() == 0)
+    if (primitives().empty())
     {
         throw std::invalid_argument("No objects in the scene");
     }
-}
\ No newline at end of file
+}
+
+std::vector<object::PrimitiveRef> Scene::primitives() const
+{
+    std::vector<object::PrimitiveRef> refs;
+    auto add = [&](object::PrimitiveType type, size_t count)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            refs.push_back({type, (uint32_t)i});
+        }
+    };
+    add(object::SPHERE, mSpheres.size());
+    add(object::SPHERE_VOLUME, mSphereVolumes.size());
+    add(object::QUADRIC, mQuadrics.size());
+    add(object::TRIANGLE, mTriangles.size());
+    add(object::QUAD, mQuads.size());
+    add(object::MODEL, mModels.size());
+    return refs;
+}
+
+/**
+ * @brief Rebuild one primitive array in the order of the refs of its
+ * type, and point those refs at the new positions.
+ */
+template <typename T>
+static void reorderArray(std::vector<T> &array, object::PrimitiveType type, std::vector<object::PrimitiveRef> &refs,
+                         std::map<const object::Primitive *, const object::Primitive *> &moved)
+{
+    std::vector<T> sorted;
+    sorted.reserve(array.size());
+    for (object::PrimitiveRef &ref : refs)
+    {
+        if (ref.mType == type)
+        {
+            sorted.push_back(array.at(ref.mIndex));
+            moved[&array[ref.mIndex]] = &sorted.back();
+            ref.mIndex = sorted.size() - 1;
+        }
+    }
+    if (sorted.size() != array.size())
+    {
+        throw std::invalid_argument("Primitive order must reference every primitive once");
+    }
+    // Moving the vector keeps its buffer, so the new addresses stay valid
+    array = std::move(sorted);
+}
+
+void Scene::reorder(std::vector<object::PrimitiveRef> &refs)
+{
+    std::map<const object::Primitive *, const object::Primitive *> moved;
+    reorderArray(mSpheres, object::SPHERE, refs, moved);
+    reorderArray(mSphereVolumes, object::SPHERE_VOLUME, refs, moved);
+    reorderArray(mQuadrics, object::QUADRIC, refs, moved);
+    reorderArray(mTriangles, object::TRIANGLE, refs, moved);
+    reorderArray(mQuads, object::QUAD, refs, moved);
+    reorderArray(mModels, object::MODEL, refs, moved);
+    for (const object::Primitive *&light : mLights)
+    {
+        light = moved.at(light);
+    }
+}
+
+size_t Scene::bakeModels(size_t budget)
+{
+    size_t used = 0;
+    size_t baked = 0;
+    for (object::Model &model : mModels)
+    {
+        size_t size = model.mMesh.bakedSize();
+        if (model.mBaked || used + size > budget)
+        {
+            continue;
+        }
+        mBakedMeshes.push_back(std::make_unique<Mesh>(model.mMesh, model.mModelMatrix));
+        model.mBaked = mBakedMeshes.back().get();
+        used += size;
+        baked++;
+    }
+    return baked;
+}
+
+const object::Primitive &Scene::primitive(object::PrimitiveRef ref) const
+{
+    switch (ref.mType)
+    {
+    case object::SPHERE:
+        return mSpheres.at(ref.mIndex);
+    case object::SPHERE_VOLUME:
+        return mSphereVolumes.at(ref.mIndex);
+    case object::QUADRIC:
+        return mQuadrics.at(ref.mIndex);
+    case object::TRIANGLE:
+        return mTriangles.at(ref.mIndex);
+    case object::QUAD:
+        return mQuads.at(ref.mIndex);
+    case object::MODEL:
+        return mModels.at(ref.mIndex);
+    }
+    throw std::out_of_range("Invalid primitive type");
+}
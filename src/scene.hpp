@@ -11,8 +11,44 @@
 #include "boundingBox.hpp"
 #include "perlin.hpp"
 
+class Mesh;
+
 namespace object
 {
+    // Concrete primitive types. The Scene keeps each type in its own array.
+    enum PrimitiveType : uint32_t
+    {
+        SPHERE = 0,
+        SPHERE_VOLUME,
+        QUADRIC,
+        TRIANGLE,
+        QUAD,
+        MODEL,
+        NUM_PRIMITIVE_TYPES,
+    };
+
+    /**
+     * @brief A primitive's type and index into that type's array. Lets
+     * BVH leaves dispatch with a switch instead of a virtual call.
+     */
+    struct PrimitiveRef
+    {
+        uint32_t mType;
+        uint32_t mIndex;
+    };
+
+    /**
+     * @brief Result of Primitive::intersect(). Just enough about the hit
+     * point for shade() to finish the job once the closest hit is known.
+     */
+    struct Hit
+    {
+        double mT;               // Time t of collision. Always > 0.
+        PrimitiveRef mPrimitive; // Filled in by Scene::intersect()
+        double mU, mV;           // Triangles: barycentric beta/gamma. Quads: alpha/beta. Volumes: scatter time.
+        uint32_t mTriangle;      // Models: index of the hit triangle in the mesh
+    };
+
     class Primitive
     {
     public:
@@ -32,6 +68,7 @@ namespace object
         STBImage *mTexture;
         BoundingBox mBoundingBox;
         Perlin *mPerlin;
+        bool mIsLight = false; // In Scene::mLights
 
         Primitive();
         Primitive(nlohmann::json &json);
@@ -39,14 +76,30 @@ namespace object
         virtual ~Primitive() {};
 
         /**
-         * @brief Collide a ray with this object.
+         * @brief Check if a ray hits this object, without any shading.
+         * Cheap enough to call on every primitive a ray might hit, it
+         * doesn't touch the ray, textures, or the random number generator
+         * (except volumes, which pick their scatter distance here).
          *
          * @param incoming Incoming ray
-         * @param t Time t of collision with the object. Always > 0.
+         * @param hit Filled in with the time t and surface coordinates of
+         * the hit. hit.mT starts out as the closest hit found so far, hits
+         * past it don't matter and may be skipped.
+         * @return true if the ray hit the object
+         */
+        virtual bool intersect(const Ray &incoming, Hit &hit) const = 0;
+
+        /**
+         * @brief Shade a hit found by intersect(): look up the color at
+         * the hit point and bounce the ray off of it. Only called for
+         * the closest hit along a ray.
+         *
+         * @param hit Hit returned by intersect() for incoming
+         * @param incoming Incoming ray, replaced by the bounced ray
          * @param color Color of the object at the collision point.
          * @return enum Collision Type of collision that occurred
          */
-        virtual enum Collision collide(Ray &incoming, double &t, Color &color) const = 0;
+        virtual enum Collision shade(const Hit &hit, Ray &incoming, Color &color) const = 0;
 
         /**
          * @brief Return the bounding box for this primitive.
@@ -55,6 +108,43 @@ namespace object
          */
         virtual BoundingBox boundingBox() const;
 
+        /**
+         * @brief Surface area of the primitive, or 0 if it can't be
+         * sampled as a light.
+         */
+        virtual double area() const;
+
+        /**
+         * @brief Pick a uniformly distributed random point on the
+         * surface. Only implemented for primitives with an area().
+         *
+         * @param point Random point on the surface
+         * @param normal Normal vector of the surface at that point
+         */
+        virtual void samplePoint(Vector &point, Vector &normal) const;
+
+        /**
+         * @brief Pick a random direction from a point towards this
+         * primitive, for sampling it as a light.
+         *
+         * @param from Point being lit
+         * @param dir Normalized direction towards the primitive
+         * @param pdf Probability density of dir, per unit solid angle
+         * @return false if no direction could be found
+         */
+        virtual bool sampleLight(const Vector &from, Vector &dir, double &pdf) const;
+
+        /**
+         * @brief Probability density per unit solid angle of
+         * sampleLight() picking the direction from one point to
+         * another point on this primitive.
+         *
+         * @param from Point being lit
+         * @param point Point on the primitive
+         * @param normal Normal vector of the primitive at point
+         */
+        virtual double lightPdf(const Vector &from, const Vector &point, const Vector &normal) const;
+
         /**
          * @brief Perform a texture lookup, returning a color.
          */
@@ -121,8 +211,22 @@ namespace object
         Triangle(Vector vertices[3], Vector texcoords[3], enum Color::Surface surface, double indexOfRefraction, const Color &color);
         Triangle(nlohmann::json &json);
 
-        enum Collision collide(Ray &incoming, double &t, Color &color) const override;
+        bool intersect(const Ray &incoming, Hit &hit) const override;
+        enum Collision shade(const Hit &hit, Ray &incoming, Color &color) const override;
         BoundingBox boundingBox() const override;
+        double area() const override;
+        void samplePoint(Vector &point, Vector &normal) const override;
+
+        /**
+         * @brief Ray-triangle intersection test without any shading.
+         * The ray direction doesn't need to be normalized.
+         *
+         * @param incoming Incoming ray
+         * @param t Time t of collision with the triangle
+         * @param alpha, beta, gamma Barycentric coordinates of the collision
+         * @return true if the ray hit the triangle
+         */
+        bool intersect(const Ray &incoming, double &t, double &alpha, double &beta, double &gamma) const;
 
     private:
         void textureLookup(double alpha, double beta, double gamma, const Vector &intersection, Color &color) const;
@@ -141,7 +245,8 @@ namespace object
         Quadric(const Vector &center, double a2, double b2, double c2, double d2, double maxOnAxis, double maxOffAxis, const std::string &axis, enum Color::Surface surface, double indexOfRefraction, const Color &color);
         Quadric(nlohmann::json json);
 
-        virtual enum Collision collide(Ray &incoming, double &t, Color &color) const override;
+        virtual bool intersect(const Ray &incoming, Hit &hit) const override;
+        virtual enum Collision shade(const Hit &hit, Ray &incoming, Color &color) const override;
         virtual BoundingBox boundingBox() const override;
 
     private:
@@ -163,8 +268,15 @@ namespace object
         Sphere(const Vector &origin, double radius, enum Color::Surface surface, double indexOfRefraction, const Color &color);
         Sphere(nlohmann::json &json);
 
-        virtual enum Collision collide(Ray &incoming, double &t, Color &color) const override;
+        virtual bool intersect(const Ray &incoming, Hit &hit) const override;
+        virtual enum Collision shade(const Hit &hit, Ray &incoming, Color &color) const override;
         virtual BoundingBox boundingBox() const override;
+        virtual double area() const override;
+
+        // Spheres are sampled by the cone of directions they cover as
+        // seen from the lit point, not by area
+        bool sampleLight(const Vector &from, Vector &dir, double &pdf) const override;
+        double lightPdf(const Vector &from, const Vector &point, const Vector &normal) const override;
 
     private:
         void textureLookup(Vector &intersection, Color &color) const;
@@ -181,25 +293,36 @@ namespace object
         Quad(const Vector &origin, const Vector &width, const Vector &height, enum Color::Surface surface, double indexOfRefraction, const Color &color);
         Quad(nlohmann::json &json);
 
-        enum Collision collide(Ray &incoming, double &t, Color &color) const override;
+        bool intersect(const Ray &incoming, Hit &hit) const override;
+        enum Collision shade(const Hit &hit, Ray &incoming, Color &color) const override;
         BoundingBox boundingBox() const override;
+        double area() const override;
+        void samplePoint(Vector &point, Vector &normal) const override;
 
     private:
         void textureLookup(double alpha, double beta, const Vector &intersection, Color &color) const;
         Vector mW; // Used for intersection checking
     };
 
+    /**
+     * @brief Instance of a Mesh, placed in the scene with a model
+     * matrix. Rays are transformed into the mesh's object space and
+     * tested against its triangle BVH.
+     */
     class Model : public Primitive
     {
     public:
         ModelMatrix mModelMatrix;
 
-        tinyobj::ObjReader &mObj;
+        const Mesh &mMesh;
+        const Mesh *mBaked; // mMesh moved into world space, traced instead of it. NULL if not baked.
 
-        Model(tinyobj::ObjReader &obj, const Vector &origin, const Vector &front, const Vector &top, const Vector &scale, enum Color::Surface surface, double indexOfRefraction, const Color &color);
-        Model(nlohmann::json &json, tinyobj::ObjReader &obj);
+        Model(const Mesh &mesh, const Vector &origin, const Vector &front, const Vector &top, const Vector &scale, enum Color::Surface surface, double indexOfRefraction, const Color &color);
+        Model(const Mesh &mesh, const ModelMatrix &modelMatrix, enum Color::Surface surface, double indexOfRefraction, const Color &color);
+        Model(nlohmann::json &json, const Mesh &mesh);
 
-        enum Collision collide(Ray &incoming, double &t, Color &color) const override;
+        bool intersect(const Ray &incoming, Hit &hit) const override;
+        enum Collision shade(const Hit &hit, Ray &incoming, Color &color) const override;
         // No texture lookup support
         BoundingBox boundingBox() const override;
     };
@@ -212,9 +335,12 @@ namespace object
         SphereVolume(const Vector &origin, double radius, double density, Color &color);
         SphereVolume(nlohmann::json &json);
 
-        enum Collision collide(Ray &incoming, double &t, Color &color) const override;
+        bool intersect(const Ray &incoming, Hit &hit) const override;
+        enum Collision shade(const Hit &hit, Ray &incoming, Color &color) const override;
         // No texture lookup support
         BoundingBox boundingBox() const override;
+        // Volumes can't be sampled as lights
+        double area() const override;
     };
 
     /**
@@ -242,13 +368,27 @@ class Scene
 public:
     object::Camera mCamera;
 
-    // List of scene objects. Must be unique_ptr otherwise polymorphism breaks
-    std::vector<std::unique_ptr<object::Primitive>> mPrimitives;
-
-    // List of OBJ files, containing their assets
-    std::vector<tinyobj::ObjReader> mObjReaders;
+    // Scene objects, one contiguous array per type (see PrimitiveRef).
+    // Sized once by load(), mLights and rays point into them.
+    std::vector<object::Sphere> mSpheres;
+    std::vector<object::SphereVolume> mSphereVolumes;
+    std::vector<object::Quadric> mQuadrics;
+    std::vector<object::Triangle> mTriangles;
+    std::vector<object::Quad> mQuads;
+    std::vector<object::Model> mModels;
+
+    // Emissive primitives that can be sampled directly
+    std::vector<const object::Primitive *> mLights;
+
+    // List of meshes loaded from OBJ files, shared by every Model
+    // instance of the same file
+    std::vector<std::unique_ptr<Mesh>> mMeshes;
     std::vector<std::string> mObjFilenames;
 
+    // World space copies of meshes made by bakeModels(), one per baked
+    // Model
+    std::vector<std::unique_ptr<Mesh>> mBakedMeshes;
+
     // List of textures
     std::vector<std::unique_ptr<STBImage>> mTextures;
     std::vector<std::string> mTextureFilenames;
@@ -263,8 +403,94 @@ public:
      * populate all of the objects at their correct coordinates.
      *
      * @param sceneJsonPath
+     * @param jobs Number of threads to build mesh BVHs with
+     */
+    void load(std::string sceneJsonPath, int jobs = 1);
+
+    /**
+     * @brief References to every primitive in the scene, in array order.
+     */
+    std::vector<object::PrimitiveRef> primitives() const;
+
+    /**
+     * @brief Look up a primitive by reference. Goes through the base
+     * class, so calls on it are still virtual.
+     */
+    const object::Primitive &primitive(object::PrimitiveRef ref) const;
+
+    /**
+     * @brief Sort each primitive array into the order its primitives
+     * appear in refs, e.g. BVH leaf order, so neighbouring leaves read
+     * neighbouring memory. Updates refs and mLights to match.
+     */
+    void reorder(std::vector<object::PrimitiveRef> &refs);
+
+    /**
+     * @brief Bake Models into world space, in scene order, as long as
+     * the baked copies fit in a memory budget. A baked Model is traced
+     * without moving every ray into object space, but needs its own
+     * copy of the mesh's triangles and BVH. The rest stay instanced,
+     * sharing their Mesh.
+     *
+     * @param budget Bytes the baked copies can take in total
+     * @return Number of Models baked
      */
-    void load(std::string sceneJsonPath);
+    size_t bakeModels(size_t budget);
+
+    /**
+     * @brief Primitive::intersect() on a referenced primitive, without
+     * the virtual call. This is what BVH leaves call.
+     */
+    inline bool intersect(object::PrimitiveRef ref, const Ray &incoming, object::Hit &hit) const
+    {
+        // Qualified calls, the type is already known so skip the vtable
+        hit.mPrimitive = ref;
+        switch (ref.mType)
+        {
+        case object::SPHERE:
+            return mSpheres[ref.mIndex].Sphere::intersect(incoming, hit);
+        case object::SPHERE_VOLUME:
+            return mSphereVolumes[ref.mIndex].SphereVolume::intersect(incoming, hit);
+        case object::QUADRIC:
+            return mQuadrics[ref.mIndex].Quadric::intersect(incoming, hit);
+        case object::TRIANGLE:
+            return mTriangles[ref.mIndex].Triangle::intersect(incoming, hit);
+        case object::QUAD:
+            return mQuads[ref.mIndex].Quad::intersect(incoming, hit);
+        case object::MODEL:
+            return mModels[ref.mIndex].Model::intersect(incoming, hit);
+        }
+        return false;
+    }
+
+    /**
+     * @brief Primitive::shade() on the primitive a hit belongs to.
+     */
+    inline object::Primitive::Collision shade(const object::Hit &hit, Ray &incoming, Color &color) const
+    {
+        object::PrimitiveRef ref = hit.mPrimitive;
+        switch (ref.mType)
+        {
+        case object::SPHERE:
+            return mSpheres[ref.mIndex].Sphere::shade(hit, incoming, color);
+        case object::SPHERE_VOLUME:
+            return mSphereVolumes[ref.mIndex].SphereVolume::shade(hit, incoming, color);
+        case object::QUADRIC:
+            return mQuadrics[ref.mIndex].Quadric::shade(hit, incoming, color);
+        case object::TRIANGLE:
+            return mTriangles[ref.mIndex].Triangle::shade(hit, incoming, color);
+        case object::QUAD:
+            return mQuads[ref.mIndex].Quad::shade(hit, incoming, color);
+        case object::MODEL:
+            return mModels[ref.mIndex].Model::shade(hit, incoming, color);
+        }
+        return object::Primitive::Collision::MISSED;
+    }
 
 private:
+    /**
+     * @brief Convert a JSON object type ("sphere", "obj", ...) to a
+     * primitive type.
+     */
+    static object::PrimitiveType stringToType(const std::string &str);
 };
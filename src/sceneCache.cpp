@@ -0,0 +1,684 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <unordered_map>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "sceneCache.hpp"
+#include "mesh.hpp"
+
+// Cache file layout, host byte order. Arrays are prefixed with a
+// uint64_t element count and start 8 byte aligned so they can be used
+// straight out of the mapping.
+//   magic, version, sizeof(scalar_t), split method, expected cost
+//   inputs: count, then path, size, mtime, hash of each
+//   camera: origin, front, top, focal length, lens diameter, emissive gain
+//   textures: count, then width, height, channels, pixels of each
+//   meshes: count, then triangle vertices and BVH of each
+//   primitives: records grouped by type, in Scene array order
+//   lights: PrimitiveRefs
+//   scene BVH
+// BVHs are a node array followed by an array of PrimitiveRefs.
+static const uint32_t sCacheMagic = 0x43535452; // "RTSC"
+static const uint32_t sCacheVersion = 4;
+
+// Everything needed to rebuild one primitive
+struct PrimitiveRecord
+{
+    uint32_t mType; // object::PrimitiveType
+    uint32_t mSurface;
+    int32_t mTexture; // Index into the texture list, -1 for none
+    int32_t mMesh;    // Models only, index into the mesh list
+    uint32_t mPerlin;
+    uint32_t mIsLight;
+    double mIndexOfRefraction;
+    double mColor[3];
+    double mData[15]; // Type specific, see writePrimitive()
+};
+
+/**
+ * @brief Sequential writer for the cache file.
+ */
+class CacheWriter
+{
+public:
+    std::ofstream mOut;
+    size_t mOffset = 0;
+
+    CacheWriter(const std::string &path) : mOut(path, std::ios::out | std::ios::binary) {}
+
+    void write(const void *data, size_t size)
+    {
+        mOut.write((const char *)data, size);
+        mOffset += size;
+    }
+
+    template <typename T>
+    void value(T val)
+    {
+        write(&val, sizeof(T));
+    }
+
+    template <typename T>
+    void array(const T *data, size_t count)
+    {
+        value((uint64_t)count);
+        static const char zeros[8] = {0};
+        write(zeros, (8 - mOffset % 8) % 8);
+        write(data, count * sizeof(T));
+    }
+
+    void string(const std::string &str)
+    {
+        array(str.data(), str.size());
+    }
+};
+
+/**
+ * @brief Bounds checked sequential reader over the mapped cache file.
+ * Throws std::runtime_error if the file is cut short.
+ */
+class CacheReader
+{
+public:
+    const uint8_t *mData;
+    size_t mSize;
+    size_t mOffset = 0;
+
+    CacheReader(const void *data, size_t size) : mData((const uint8_t *)data), mSize(size) {}
+
+    const void *read(size_t size)
+    {
+        if (size > mSize - mOffset)
+        {
+            throw std::runtime_error("File is truncated");
+        }
+        const void *data = mData + mOffset;
+        mOffset += size;
+        return data;
+    }
+
+    template <typename T>
+    T value()
+    {
+        T val;
+        std::memcpy(&val, read(sizeof(T)), sizeof(T));
+        return val;
+    }
+
+    template <typename T>
+    const T *array(size_t &count)
+    {
+        count = value<uint64_t>();
+        read((8 - mOffset % 8) % 8);
+        if (count > (mSize - mOffset) / sizeof(T))
+        {
+            throw std::runtime_error("File is truncated");
+        }
+        return (const T *)read(count * sizeof(T));
+    }
+
+    std::string string()
+    {
+        size_t length;
+        const char *str = array<char>(length);
+        return std::string(str, length);
+    }
+};
+
+/**
+ * @brief 64-bit FNV-1a hash of a file's contents.
+ */
+static uint64_t hashFile(const std::string &path)
+{
+    std::ifstream in(path, std::ios::in | std::ios::binary);
+    if (!in)
+    {
+        throw std::runtime_error("Can't open " + path);
+    }
+    uint64_t hash = 0xcbf29ce484222325;
+    std::vector<char> buffer(1 << 20);
+    while (in)
+    {
+        in.read(buffer.data(), buffer.size());
+        for (std::streamsize i = 0; i < in.gcount(); i++)
+        {
+            hash = (hash ^ (uint8_t)buffer[i]) * 0x100000001b3;
+        }
+    }
+    return hash;
+}
+
+/**
+ * @brief Size and modification time (ns) of a file. Returns false if
+ * the file doesn't exist.
+ */
+static bool statFile(const std::string &path, uint64_t &size, int64_t &mtime)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+    {
+        return false;
+    }
+    size = st.st_size;
+    mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    return true;
+}
+
+static void writeVector(double *out, const Vector &vec)
+{
+    out[0] = vec[0];
+    out[1] = vec[1];
+    out[2] = vec[2];
+}
+
+static Vector readVector(const double *in)
+{
+    return Vector(in[0], in[1], in[2]);
+}
+
+static void writeBvh(CacheWriter &out, const FlatBoundingVolumeHierarchy &bvh)
+{
+    out.array(bvh.mNodes.data(), bvh.mNodes.size());
+    out.array(bvh.mPrimitives.data(), bvh.mPrimitives.size());
+}
+
+/**
+ * @brief Check a primitive reference against the number of primitives
+ * of each type.
+ */
+static object::PrimitiveRef checkRef(object::PrimitiveRef ref, const size_t counts[object::NUM_PRIMITIVE_TYPES])
+{
+    if (ref.mType >= object::NUM_PRIMITIVE_TYPES || ref.mIndex >= counts[ref.mType])
+    {
+        throw std::runtime_error("Corrupt primitive reference");
+    }
+    return ref;
+}
+
+static void readBvh(CacheReader &in, FlatBoundingVolumeHierarchy &bvh, const size_t counts[object::NUM_PRIMITIVE_TYPES])
+{
+    size_t numNodes, numPrimitives;
+    const FlatBoundingVolumeHierarchy::Node *nodes = in.array<FlatBoundingVolumeHierarchy::Node>(numNodes);
+    const object::PrimitiveRef *refs = in.array<object::PrimitiveRef>(numPrimitives);
+
+    // Traversal trusts the offsets, so check them once here
+    for (size_t i = 0; i < numNodes; i++)
+    {
+        bool valid = nodes[i].mCount > 0 ? (size_t)nodes[i].mOffset + nodes[i].mCount <= numPrimitives
+                                         : nodes[i].mOffset > i + 1 && nodes[i].mOffset < numNodes;
+        if (!valid)
+        {
+            throw std::runtime_error("Corrupt BVH");
+        }
+    }
+    bvh.mNodes.assign(nodes, nodes + numNodes);
+    for (size_t i = 0; i < numPrimitives; i++)
+    {
+        bvh.mPrimitives.push_back(checkRef(refs[i], counts));
+    }
+}
+
+static PrimitiveRecord writePrimitive(const Scene &scene, object::PrimitiveRef ref, int32_t texture, int32_t mesh)
+{
+    const object::Primitive &p = scene.primitive(ref);
+    PrimitiveRecord record = {};
+    record.mType = ref.mType;
+    record.mSurface = p.mSurface;
+    record.mTexture = texture;
+    record.mMesh = mesh;
+    record.mPerlin = p.mPerlin != NULL;
+    record.mIsLight = p.mIsLight;
+    record.mIndexOfRefraction = p.mIndexOfRefraction;
+    writeVector(record.mColor, p.mColor);
+
+    switch (ref.mType)
+    {
+    case object::SPHERE_VOLUME:
+    {
+        const object::SphereVolume &volume = scene.mSphereVolumes[ref.mIndex];
+        writeVector(record.mData, volume.mOrigin);
+        record.mData[3] = volume.mRadius;
+        record.mData[4] = volume.mNegInvDensity;
+        break;
+    }
+    case object::SPHERE:
+    {
+        const object::Sphere &sphere = scene.mSpheres[ref.mIndex];
+        writeVector(record.mData, sphere.mOrigin);
+        record.mData[3] = sphere.mRadius;
+        break;
+    }
+    case object::QUADRIC:
+    {
+        const object::Quadric &quadric = scene.mQuadrics[ref.mIndex];
+        writeVector(record.mData, quadric.mOrigin);
+        record.mData[3] = quadric.mA2;
+        record.mData[4] = quadric.mB2;
+        record.mData[5] = quadric.mC2;
+        record.mData[6] = quadric.mD2;
+        record.mData[7] = quadric.mMaxOnAxis;
+        record.mData[8] = quadric.mMaxOffAxis;
+        record.mData[9] = quadric.mAxis[0] - 'x';
+        break;
+    }
+    case object::TRIANGLE:
+    {
+        const object::Triangle &triangle = scene.mTriangles[ref.mIndex];
+        for (int i = 0; i < 3; i++)
+        {
+            writeVector(&record.mData[i * 3], triangle.mVertices[i]);
+            record.mData[9 + i * 2] = triangle.mTexcoords[i][0];
+            record.mData[10 + i * 2] = triangle.mTexcoords[i][1];
+        }
+        break;
+    }
+    case object::QUAD:
+    {
+        const object::Quad &quad = scene.mQuads[ref.mIndex];
+        writeVector(record.mData, quad.mOrigin);
+        writeVector(&record.mData[3], quad.mWidth);
+        writeVector(&record.mData[6], quad.mHeight);
+        break;
+    }
+    case object::MODEL:
+    {
+        const object::Model &model = scene.mModels[ref.mIndex];
+        writeVector(record.mData, model.mModelMatrix.mOrigin);
+        writeVector(&record.mData[3], model.mModelMatrix.mFront);
+        writeVector(&record.mData[6], model.mModelMatrix.mTop);
+        writeVector(&record.mData[9], model.mModelMatrix.mScale);
+        break;
+    }
+    }
+    return record;
+}
+
+/**
+ * @brief Append a primitive to the scene array for its type. The arrays
+ * must have been reserved, they can't move once lights point into them.
+ */
+static object::Primitive &readPrimitive(const PrimitiveRecord &record, Scene &scene)
+{
+    const double *data = record.mData;
+    enum Color::Surface surface = (enum Color::Surface)record.mSurface;
+    Color color = readVector(record.mColor);
+    object::Primitive *p;
+    switch (record.mType)
+    {
+    case object::SPHERE_VOLUME:
+        scene.mSphereVolumes.emplace_back(readVector(data), data[3], -1.0 / data[4], color);
+        p = &scene.mSphereVolumes.back();
+        break;
+    case object::SPHERE:
+        scene.mSpheres.emplace_back(readVector(data), data[3], surface, record.mIndexOfRefraction, color);
+        p = &scene.mSpheres.back();
+        break;
+    case object::QUADRIC:
+        scene.mQuadrics.emplace_back(readVector(data), data[3], data[4], data[5], data[6], data[7], data[8],
+                                     std::string(1, 'x' + (int)data[9]), surface, record.mIndexOfRefraction, color);
+        p = &scene.mQuadrics.back();
+        break;
+    case object::TRIANGLE:
+    {
+        Vector vertices[3], texcoords[3];
+        for (int i = 0; i < 3; i++)
+        {
+            vertices[i] = readVector(&data[i * 3]);
+            texcoords[i] = Vector(data[9 + i * 2], data[10 + i * 2], 0.0);
+        }
+        scene.mTriangles.emplace_back(vertices, texcoords, surface, record.mIndexOfRefraction, color);
+        p = &scene.mTriangles.back();
+        break;
+    }
+    case object::QUAD:
+        scene.mQuads.emplace_back(readVector(data), readVector(&data[3]), readVector(&data[6]), surface, record.mIndexOfRefraction, color);
+        p = &scene.mQuads.back();
+        break;
+    case object::MODEL:
+        if (record.mMesh < 0 || (size_t)record.mMesh >= scene.mMeshes.size())
+        {
+            throw std::runtime_error("Corrupt primitive");
+        }
+        scene.mModels.emplace_back(*scene.mMeshes[record.mMesh],
+                                   ModelMatrix(readVector(data), readVector(&data[3]), readVector(&data[6]), readVector(&data[9])),
+                                   surface, record.mIndexOfRefraction, color);
+        p = &scene.mModels.back();
+        break;
+    default:
+        throw std::runtime_error("Corrupt primitive");
+    }
+    // The constructors above fill in some defaults, put back what was saved
+    p->mSurface = surface;
+    p->mIndexOfRefraction = record.mIndexOfRefraction;
+    p->mBoundingBox = p->boundingBox();
+    p->mIsLight = record.mIsLight;
+    if (record.mTexture >= 0)
+    {
+        if ((size_t)record.mTexture >= scene.mTextures.size())
+        {
+            throw std::runtime_error("Corrupt primitive");
+        }
+        p->mTexture = scene.mTextures[record.mTexture].get();
+    }
+    if (record.mPerlin)
+    {
+        p->mPerlin = &scene.mPerlin;
+    }
+    return *p;
+}
+
+/**
+ * @brief Empty out everything load() may have filled in.
+ */
+static void clearScene(Scene &scene)
+{
+    scene.mSpheres.clear();
+    scene.mSphereVolumes.clear();
+    scene.mQuadrics.clear();
+    scene.mTriangles.clear();
+    scene.mQuads.clear();
+    scene.mModels.clear();
+    scene.mLights.clear();
+    scene.mMeshes.clear();
+    scene.mObjFilenames.clear();
+    scene.mTextures.clear();
+    scene.mTextureFilenames.clear();
+}
+
+SceneCache::SceneCache(std::string sceneJsonPath) : mSceneJsonPath(sceneJsonPath), mPath(sceneJsonPath + ".cache"), mMap(NULL), mMapSize(0) {}
+
+SceneCache::~SceneCache()
+{
+    unmap();
+}
+
+void SceneCache::unmap()
+{
+    if (mMap)
+    {
+        munmap(mMap, mMapSize);
+        mMap = NULL;
+        mMapSize = 0;
+    }
+}
+
+bool SceneCache::load(Scene &scene, std::unique_ptr<FlatBoundingVolumeHierarchy> &bvh, double &expectedCost, BoundingVolumeHierarchy::SplitMethod splitMethod)
+{
+    int fd = open(mPath.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        close(fd);
+        return false;
+    }
+    mMap = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mMap == MAP_FAILED)
+    {
+        mMap = NULL;
+        return false;
+    }
+    mMapSize = st.st_size;
+
+    try
+    {
+        CacheReader in(mMap, mMapSize);
+        if (in.value<uint32_t>() != sCacheMagic || in.value<uint32_t>() != sCacheVersion ||
+            in.value<uint32_t>() != sizeof(scalar_t))
+        {
+            throw std::runtime_error("Written by a different version");
+        }
+        if (in.value<uint32_t>() != (uint32_t)splitMethod)
+        {
+            std::cout << "Scene cache was built with a different BVH split method, rebuilding." << std::endl;
+            unmap();
+            return false;
+        }
+        double cost = in.value<double>();
+
+        // Inputs. Hashing is only needed when a file was touched
+        // without changing its size, e.g. by a checkout.
+        std::vector<std::string> inputs;
+        size_t numInputs = in.value<uint64_t>();
+        for (size_t i = 0; i < numInputs; i++)
+        {
+            std::string path = in.string();
+            uint64_t size = in.value<uint64_t>();
+            int64_t mtime = in.value<int64_t>();
+            uint64_t hash = in.value<uint64_t>();
+            uint64_t currentSize;
+            int64_t currentMtime;
+            if (!statFile(path, currentSize, currentMtime) || currentSize != size ||
+                (currentMtime != mtime && hashFile(path) != hash))
+            {
+                std::cout << "Scene cache is out of date (" << path << " changed), rebuilding." << std::endl;
+                unmap();
+                return false;
+            }
+            inputs.push_back(path);
+        }
+
+        // Fill in the scene as we go, clearScene() undoes it if the
+        // rest of the file turns out to be bad
+        object::Camera camera;
+        double vec[9];
+        for (int i = 0; i < 9; i++)
+        {
+            vec[i] = in.value<double>();
+        }
+        camera.mOrigin = readVector(&vec[0]);
+        camera.mFront = readVector(&vec[3]);
+        camera.mTop = readVector(&vec[6]);
+        camera.mFocalLength = in.value<double>();
+        camera.mLensDiskDiameter = in.value<double>();
+        double emissiveGain = in.value<double>();
+
+        size_t numTextures = in.value<uint64_t>();
+        for (size_t i = 0; i < numTextures; i++)
+        {
+            int width = in.value<int32_t>();
+            int height = in.value<int32_t>();
+            int channels = in.value<int32_t>();
+            size_t size;
+            const uint8_t *pixels = in.array<uint8_t>(size);
+            if (width <= 0 || height <= 0 || channels < 3 || size != (size_t)width * height * channels)
+            {
+                throw std::runtime_error("Corrupt texture");
+            }
+            scene.mTextures.push_back(std::make_unique<STBImage>(pixels, width, height, channels));
+        }
+
+        size_t numMeshes = in.value<uint64_t>();
+        for (size_t i = 0; i < numMeshes; i++)
+        {
+            auto mesh = std::make_unique<Mesh>();
+            size_t numValues;
+            const double *vertices = in.array<double>(numValues);
+            mesh->mTriangles.reserve(numValues / 9);
+            Vector triangle[3], texcoords[3];
+            for (size_t j = 0; j + 9 <= numValues; j += 9)
+            {
+                for (int k = 0; k < 3; k++)
+                {
+                    triangle[k] = readVector(&vertices[j + k * 3]);
+                }
+                mesh->mTriangles.emplace_back(triangle, texcoords, Color::DIFFUSE, 0.0, Color(0, 0, 0));
+            }
+            size_t counts[object::NUM_PRIMITIVE_TYPES] = {0};
+            counts[object::TRIANGLE] = mesh->mTriangles.size();
+            mesh->mBvh = std::make_unique<FlatBoundingVolumeHierarchy>();
+            readBvh(in, *mesh->mBvh, counts);
+            mesh->mBuffer = TriangleBuffer(mesh->mTriangles);
+            scene.mMeshes.push_back(std::move(mesh));
+        }
+
+        size_t counts[object::NUM_PRIMITIVE_TYPES] = {0};
+        size_t numRecords;
+        const PrimitiveRecord *records = in.array<PrimitiveRecord>(numRecords);
+        for (size_t i = 0; i < numRecords; i++)
+        {
+            if (records[i].mType >= object::NUM_PRIMITIVE_TYPES)
+            {
+                throw std::runtime_error("Corrupt primitive");
+            }
+            counts[records[i].mType]++;
+        }
+        scene.mSpheres.reserve(counts[object::SPHERE]);
+        scene.mSphereVolumes.reserve(counts[object::SPHERE_VOLUME]);
+        scene.mQuadrics.reserve(counts[object::QUADRIC]);
+        scene.mTriangles.reserve(counts[object::TRIANGLE]);
+        scene.mQuads.reserve(counts[object::QUAD]);
+        scene.mModels.reserve(counts[object::MODEL]);
+        for (size_t i = 0; i < numRecords; i++)
+        {
+            readPrimitive(records[i], scene);
+        }
+
+        size_t numLights;
+        const object::PrimitiveRef *lights = in.array<object::PrimitiveRef>(numLights);
+        for (size_t i = 0; i < numLights; i++)
+        {
+            scene.mLights.push_back(&scene.primitive(checkRef(lights[i], counts)));
+        }
+
+        auto sceneBvh = std::make_unique<FlatBoundingVolumeHierarchy>();
+        readBvh(in, *sceneBvh, counts);
+
+        // Regenerate the noise like Scene::load() does, so seeded
+        // renders come out the same with or without the cache
+        scene.mPerlin = Perlin();
+        scene.mCamera = camera;
+        object::Primitive::sEmissiveGain = emissiveGain;
+        scene.mObjFilenames.assign(inputs.begin() + 1, inputs.begin() + 1 + numMeshes);
+        scene.mTextureFilenames.assign(inputs.begin() + 1 + numMeshes, inputs.end());
+        bvh = std::move(sceneBvh);
+        expectedCost = cost;
+        return true;
+    }
+    catch (const std::exception &e)
+    {
+        std::cout << "Ignoring scene cache " << mPath << ": " << e.what() << std::endl;
+        clearScene(scene);
+        unmap();
+        return false;
+    }
+}
+
+void SceneCache::save(const Scene &scene, const FlatBoundingVolumeHierarchy &bvh, double expectedCost, BoundingVolumeHierarchy::SplitMethod splitMethod)
+{
+    std::string tmpPath = mPath + ".tmp";
+    try
+    {
+        CacheWriter out(tmpPath);
+        out.value(sCacheMagic);
+        out.value(sCacheVersion);
+        out.value((uint32_t)sizeof(scalar_t));
+        out.value((uint32_t)splitMethod);
+        out.value(expectedCost);
+
+        // The JSON, then OBJ files in mesh order, then textures in texture order
+        std::vector<std::string> inputs = {mSceneJsonPath};
+        inputs.insert(inputs.end(), scene.mObjFilenames.begin(), scene.mObjFilenames.end());
+        inputs.insert(inputs.end(), scene.mTextureFilenames.begin(), scene.mTextureFilenames.end());
+        out.value((uint64_t)inputs.size());
+        for (const std::string &path : inputs)
+        {
+            uint64_t size;
+            int64_t mtime;
+            if (!statFile(path, size, mtime))
+            {
+                throw std::runtime_error("Can't stat " + path);
+            }
+            out.string(path);
+            out.value(size);
+            out.value(mtime);
+            out.value(hashFile(path));
+        }
+
+        double vec[9];
+        writeVector(&vec[0], scene.mCamera.mOrigin);
+        writeVector(&vec[3], scene.mCamera.mFront);
+        writeVector(&vec[6], scene.mCamera.mTop);
+        out.write(vec, sizeof(vec));
+        out.value(scene.mCamera.mFocalLength);
+        out.value(scene.mCamera.mLensDiskDiameter);
+        out.value(object::Primitive::sEmissiveGain);
+
+        std::unordered_map<const STBImage *, int32_t> textureIndices;
+        out.value((uint64_t)scene.mTextures.size());
+        for (size_t i = 0; i < scene.mTextures.size(); i++)
+        {
+            const STBImage *texture = scene.mTextures[i].get();
+            textureIndices[texture] = i;
+            out.value((int32_t)texture->mWidth);
+            out.value((int32_t)texture->mHeight);
+            out.value((int32_t)texture->mChannels);
+            out.array(texture->mImage, (size_t)texture->mWidth * texture->mHeight * texture->mChannels);
+        }
+
+        std::unordered_map<const Mesh *, int32_t> meshIndices;
+        out.value((uint64_t)scene.mMeshes.size());
+        for (size_t m = 0; m < scene.mMeshes.size(); m++)
+        {
+            const Mesh *mesh = scene.mMeshes[m].get();
+            meshIndices[mesh] = m;
+            std::vector<double> vertices(mesh->mTriangles.size() * 9);
+            for (size_t i = 0; i < mesh->mTriangles.size(); i++)
+            {
+                for (int j = 0; j < 3; j++)
+                {
+                    writeVector(&vertices[i * 9 + j * 3], mesh->mTriangles[i].mVertices[j]);
+                }
+            }
+            out.array(vertices.data(), vertices.size());
+            writeBvh(out, *mesh->mBvh);
+        }
+
+        // Lights are found by address, so remember where each primitive is
+        std::unordered_map<const object::Primitive *, object::PrimitiveRef> refs;
+        std::vector<PrimitiveRecord> records;
+        for (object::PrimitiveRef ref : scene.primitives())
+        {
+            const object::Primitive &p = scene.primitive(ref);
+            int32_t texture = p.mTexture ? textureIndices.at(p.mTexture) : -1;
+            int32_t mesh = ref.mType == object::MODEL ? meshIndices.at(&scene.mModels[ref.mIndex].mMesh) : -1;
+            refs[&p] = ref;
+            records.push_back(writePrimitive(scene, ref, texture, mesh));
+        }
+        out.array(records.data(), records.size());
+
+        std::vector<object::PrimitiveRef> lights;
+        for (const object::Primitive *light : scene.mLights)
+        {
+            lights.push_back(refs.at(light));
+        }
+        out.array(lights.data(), lights.size());
+
+        writeBvh(out, bvh);
+
+        out.mOut.close();
+        if (!out.mOut)
+        {
+            throw std::runtime_error(std::strerror(errno));
+        }
+        if (std::rename(tmpPath.c_str(), mPath.c_str()) != 0)
+        {
+            throw std::runtime_error(std::strerror(errno));
+        }
+    }
+    catch (const std::exception &e)
+    {
+        std::cout << "Failed to write scene cache " << mPath << ": " << e.what() << std::endl;
+        std::remove(tmpPath.c_str());
+    }
+}
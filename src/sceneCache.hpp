@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include "scene.hpp"
+#include "bvh.hpp"
+#include "flatBvh.hpp"
+
+/**
+ * @brief Binary copy of a loaded scene and its BVH, saved next to the
+ * scene JSON ([scene].cache) so later runs can skip parsing the JSON and
+ * OBJ files, decoding textures, and building BVHs.
+ *
+ * The file holds flat arrays: one fixed size record per primitive in
+ * BVH order, each mesh's triangle vertices and flattened BVH, the scene's
+ * flattened BVH, and decoded texture pixels. It's memory mapped on load,
+ * the arrays are copied straight out of the mapping and textures point
+ * into it, so the SceneCache has to outlive the Scene it loaded.
+ *
+ * The cache records every file the scene was built from (the JSON, OBJ
+ * files, and textures) with its size, mtime, and content hash. It's
+ * ignored if any of them changed size, or changed mtime and content.
+ */
+class SceneCache
+{
+public:
+    /**
+     * @param sceneJsonPath Scene the cache belongs to
+     */
+    SceneCache(std::string sceneJsonPath);
+    ~SceneCache();
+
+    /**
+     * @brief Fill in a scene and its BVH from the cache. Returns false,
+     * leaving the scene untouched, if there's no usable cache: missing,
+     * out of date, built with a different split method, or unreadable.
+     *
+     * @param scene Empty scene to fill in
+     * @param bvh Set to the scene's flattened BVH
+     * @param expectedCost Set to the BVH's expected cost per ray
+     */
+    bool load(Scene &scene, std::unique_ptr<FlatBoundingVolumeHierarchy> &bvh, double &expectedCost, BoundingVolumeHierarchy::SplitMethod splitMethod);
+
+    /**
+     * @brief Write the cache for a freshly loaded scene and its BVH. A
+     * cache that can't be written is reported and skipped, it's only
+     * an optimization.
+     */
+    void save(const Scene &scene, const FlatBoundingVolumeHierarchy &bvh, double expectedCost, BoundingVolumeHierarchy::SplitMethod splitMethod);
+
+private:
+    std::string mSceneJsonPath;
+    std::string mPath;
+    void *mMap;
+    size_t mMapSize;
+
+    void unmap();
+};
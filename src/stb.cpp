@@ -17,6 +17,9 @@ STBImage::STBImage(std::string path)
     }
 }
 
+STBImage::STBImage(const unsigned char *pixels, int width, int height, int channels)
+    : mImage(pixels), mWidth(width), mHeight(height), mChannels(channels), mOwned(false) {}
+
 Color STBImage::get(int y, int x)
 {
     y = CLAMP(y, 0, mHeight - 1);
@@ -44,5 +47,8 @@ double STBImage::getDbl(int y, int x, int color)
 void STBImage::free()
 {
     // Destructors and copy constructors caused problems with accidental freeing
-    stbi_image_free((void *)mImage);
+    if (mOwned)
+    {
+        stbi_image_free((void *)mImage);
+    }
 }
\ No newline at end of file
@@ -10,10 +10,17 @@ class STBImage
 public:
     const unsigned char *mImage;
     int mWidth, mHeight, mChannels;
+    bool mOwned = true; // Whether free() releases mImage
 
     STBImage();
     STBImage(std::string path);
 
+    /**
+     * @brief Wrap already decoded pixels owned by someone else, e.g.
+     * a mapped SceneCache. free() leaves them alone.
+     */
+    STBImage(const unsigned char *pixels, int width, int height, int channels);
+
     /**
      * @brief Get a pixel from the image.
      */
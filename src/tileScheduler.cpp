@@ -0,0 +1,78 @@
+#include "tileScheduler.hpp"
+
+#include <stdexcept>
+
+TileScheduler::TileScheduler(int width, int height, int tileSize, int workers)
+{
+    if (tileSize <= 0 || workers <= 0)
+    {
+        throw std::invalid_argument("Invalid tile size or worker count");
+    }
+
+    for (int y = 0; y < height; y += tileSize)
+    {
+        for (int x = 0; x < width; x += tileSize)
+        {
+            Tile tile;
+            tile.mX = x;
+            tile.mY = y;
+            tile.mWidth = (x + tileSize > width) ? width - x : tileSize;
+            tile.mHeight = (y + tileSize > height) ? height - y : tileSize;
+            mTiles.push_back(tile);
+        }
+    }
+
+    for (int i = 0; i < workers; i++)
+    {
+        mQueues.push_back(std::make_unique<Queue>());
+    }
+    reset();
+}
+
+void TileScheduler::reset()
+{
+    // Give each worker a contiguous chunk of rows so neighboring tiles
+    // (and their cache lines) stay on the same thread until stealing starts
+    size_t workers = mQueues.size();
+    for (size_t i = 0; i < workers; i++)
+    {
+        size_t start = mTiles.size() * i / workers;
+        size_t end = mTiles.size() * (i + 1) / workers;
+        mQueues[i]->mTiles.assign(mTiles.begin() + start, mTiles.begin() + end);
+    }
+}
+
+bool TileScheduler::next(int worker, Tile &tile)
+{
+    // Own queue first, from the front
+    {
+        Queue &own = *mQueues[worker];
+        std::lock_guard<std::mutex> lock(own.mLock);
+        if (!own.mTiles.empty())
+        {
+            tile = own.mTiles.front();
+            own.mTiles.pop_front();
+            return true;
+        }
+    }
+
+    // Steal from the back of the other queues, starting with our neighbor
+    // so idle workers spread out over different victims
+    for (size_t i = 1; i < mQueues.size(); i++)
+    {
+        Queue &victim = *mQueues[(worker + i) % mQueues.size()];
+        std::lock_guard<std::mutex> lock(victim.mLock);
+        if (!victim.mTiles.empty())
+        {
+            tile = victim.mTiles.back();
+            victim.mTiles.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t TileScheduler::numTiles() const
+{
+    return mTiles.size();
+}
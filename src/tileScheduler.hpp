@@ -0,0 +1,59 @@
+#pragma once
+
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <memory>
+
+/**
+ * @brief Splits an image into square tiles and hands them out to
+ * worker threads.
+ *
+ * Every worker gets its own deque of tiles, filled with a contiguous
+ * run of the image. Workers take tiles off the front of their own
+ * deque and, once it's empty, steal from the back of someone else's.
+ * Locks are per-deque and only held long enough to pop a tile, so
+ * workers only contend with each other while stealing.
+ */
+class TileScheduler
+{
+public:
+    struct Tile
+    {
+        int mX, mY;          // Top left pixel
+        int mWidth, mHeight; // Smaller than the tile size along the right/bottom edges
+    };
+
+    TileScheduler(int width, int height, int tileSize, int workers);
+
+    /**
+     * @brief Get the next tile for a worker. Thread safe.
+     *
+     * @param worker Index of the calling worker, [0, workers)
+     * @param tile Filled in with the next tile
+     * @return false if every tile has been handed out
+     */
+    bool next(int worker, Tile &tile);
+
+    /**
+     * @brief Total number of tiles in the image.
+     */
+    size_t numTiles() const;
+
+    /**
+     * @brief Refill every worker's deque so the whole image can be
+     * rendered again. Not thread safe, only call while no workers
+     * are running.
+     */
+    void reset();
+
+private:
+    struct Queue
+    {
+        std::deque<Tile> mTiles;
+        std::mutex mLock;
+    };
+
+    std::vector<Tile> mTiles;
+    std::vector<std::unique_ptr<Queue>> mQueues;
+};
@@ -0,0 +1,230 @@
+#include "triangleBuffer.hpp"
+#include "common.hpp"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+void WatertightRay::project(const Vector vertices[3], double &u, double &v, double &w, double &tScaled) const
+{
+    // Move to the ray's origin, then shear
+    double a[3], b[3], c[3];
+    for (int i = 0; i < 3; i++)
+    {
+        a[i] = (double)vertices[0][i] - mOrigin[i];
+        b[i] = (double)vertices[1][i] - mOrigin[i];
+        c[i] = (double)vertices[2][i] - mOrigin[i];
+    }
+    double ax = a[mKx] - mSx * a[mKz], ay = a[mKy] - mSy * a[mKz];
+    double bx = b[mKx] - mSx * b[mKz], by = b[mKy] - mSy * b[mKz];
+    double cx = c[mKx] - mSx * c[mKz], cy = c[mKy] - mSy * c[mKz];
+    u = cx * by - cy * bx;
+    v = ax * cy - ay * cx;
+    w = bx * ay - by * ax;
+    tScaled = mSz * (u * a[mKz] + v * b[mKz] + w * c[mKz]);
+}
+
+bool WatertightRay::intersect(const Vector vertices[3], double &t, double &beta, double &gamma) const
+{
+    double u, v, w, tScaled;
+    project(vertices, u, v, w, tScaled);
+
+    // The ray misses if the signs differ, on an edge (0) counts as a hit
+    if ((u < 0 || v < 0 || w < 0) && (u > 0 || v > 0 || w > 0))
+    {
+        return false;
+    }
+    double det = u + v + w;
+    if (det == 0.0)
+    {
+        // Incoming is parallel
+        return false;
+    }
+
+    t = tScaled / det;
+    beta = v / det;
+    gamma = w / det;
+    // Don't hit things behind us, or the surface we just left
+    return t > EPSILON;
+}
+
+TriangleBuffer::TriangleBuffer() : mSize(0) {}
+
+TriangleBuffer::TriangleBuffer(const std::vector<object::Triangle> &triangles, const ModelMatrix *modelMatrix)
+    : mSize(triangles.size())
+{
+    for (int axis = 0; axis < 3; axis++)
+    {
+        for (int vertex = 0; vertex < 3; vertex++)
+        {
+            mVertices[vertex][axis].reserve(mSize + sBatchSize - 1);
+        }
+    }
+    for (const object::Triangle &tri : triangles)
+    {
+        Vector vertices[3];
+        for (int i = 0; i < 3; i++)
+        {
+            vertices[i] = tri.mVertices[i];
+            if (modelMatrix)
+            {
+                modelMatrix->mul(vertices[i]);
+            }
+        }
+        for (int axis = 0; axis < 3; axis++)
+        {
+            for (int vertex = 0; vertex < 3; vertex++)
+            {
+                mVertices[vertex][axis].push_back(vertices[vertex][axis]);
+            }
+        }
+    }
+    for (int axis = 0; axis < 3; axis++)
+    {
+        for (int vertex = 0; vertex < 3; vertex++)
+        {
+            mVertices[vertex][axis].resize(mSize + sBatchSize - 1, 0.0f);
+        }
+    }
+}
+
+size_t TriangleBuffer::memoryUsage() const
+{
+    return (mSize + sBatchSize - 1) * 9 * sizeof(float);
+}
+
+BoundingBox TriangleBuffer::boundingBox(size_t i) const
+{
+    // Same vertices the intersection test sees
+    double min[3], max[3];
+    for (int axis = 0; axis < 3; axis++)
+    {
+        double v0 = mVertices[0][axis][i];
+        double v1 = mVertices[1][axis][i];
+        double v2 = mVertices[2][axis][i];
+        min[axis] = MIN(MIN(v0, v1), v2);
+        max[axis] = MAX(MAX(v0, v1), v2);
+    }
+    return BoundingBox(min[0], max[0], min[1], max[1], min[2], max[2]);
+}
+
+bool TriangleBuffer::intersectEach(size_t first, size_t count, const WatertightRay &ray, double tMax,
+                                   double &t, double &beta, double &gamma, uint32_t &index) const
+{
+    bool hit = false;
+    for (size_t i = first; i < first + count; i++)
+    {
+        Vector v[3];
+        vertices(i, v);
+        double thisT, thisBeta, thisGamma;
+        if (ray.intersect(v, thisT, thisBeta, thisGamma) && thisT < tMax)
+        {
+            tMax = t = thisT;
+            beta = thisBeta;
+            gamma = thisGamma;
+            index = i;
+            hit = true;
+        }
+    }
+    return hit;
+}
+
+#if defined(__AVX__)
+bool TriangleBuffer::intersect(size_t first, size_t count, const WatertightRay &ray, double tMax,
+                               double &t, double &beta, double &gamma, uint32_t &index) const
+{
+    const int axes[3] = {ray.mKx, ray.mKy, ray.mKz};
+    __m256 origin[3];
+    for (int i = 0; i < 3; i++)
+    {
+        origin[i] = _mm256_set1_ps(ray.mOrigin[axes[i]]);
+    }
+    __m256 sx = _mm256_set1_ps(ray.mSx);
+    __m256 sy = _mm256_set1_ps(ray.mSy);
+    __m256 zero = _mm256_setzero_ps();
+    // Float times are only used to skip triangles, so leave room for
+    // rounding and let the double test make the final call
+    __m256 tLimit = _mm256_set1_ps(tMax * 1.001);
+    const __m256i laneIndex = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+    bool hit = false;
+    for (size_t batch = first; batch < first + count; batch += sBatchSize)
+    {
+        // Move to the ray's origin and shear, like WatertightRay::project()
+        __m256 x[3], y[3], z[3];
+        for (int vertex = 0; vertex < 3; vertex++)
+        {
+            __m256 p[3];
+            for (int i = 0; i < 3; i++)
+            {
+                p[i] = _mm256_sub_ps(_mm256_loadu_ps(&mVertices[vertex][axes[i]][batch]), origin[i]);
+            }
+            x[vertex] = _mm256_sub_ps(p[0], _mm256_mul_ps(sx, p[2]));
+            y[vertex] = _mm256_sub_ps(p[1], _mm256_mul_ps(sy, p[2]));
+            z[vertex] = p[2];
+        }
+        __m256 u = _mm256_sub_ps(_mm256_mul_ps(x[2], y[1]), _mm256_mul_ps(y[2], x[1]));
+        __m256 v = _mm256_sub_ps(_mm256_mul_ps(x[0], y[2]), _mm256_mul_ps(y[0], x[2]));
+        __m256 w = _mm256_sub_ps(_mm256_mul_ps(x[1], y[0]), _mm256_mul_ps(y[1], x[0]));
+
+        // All the same sign, and the time is in range
+        __m256 anyNegative = _mm256_or_ps(_mm256_cmp_ps(u, zero, _CMP_LT_OQ),
+                                          _mm256_or_ps(_mm256_cmp_ps(v, zero, _CMP_LT_OQ), _mm256_cmp_ps(w, zero, _CMP_LT_OQ)));
+        __m256 anyPositive = _mm256_or_ps(_mm256_cmp_ps(u, zero, _CMP_GT_OQ),
+                                          _mm256_or_ps(_mm256_cmp_ps(v, zero, _CMP_GT_OQ), _mm256_cmp_ps(w, zero, _CMP_GT_OQ)));
+        __m256 inside = _mm256_andnot_ps(_mm256_and_ps(anyNegative, anyPositive), _mm256_set1_ps(-1.0f));
+        __m256 det = _mm256_add_ps(_mm256_add_ps(u, v), w);
+        __m256 tScaled = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(u, z[0]), _mm256_mul_ps(v, z[1])), _mm256_mul_ps(w, z[2]));
+        __m256 tBatch = _mm256_mul_ps(_mm256_div_ps(tScaled, det), _mm256_set1_ps(ray.mSz));
+        __m256 candidate = _mm256_and_ps(inside, _mm256_and_ps(_mm256_cmp_ps(tBatch, zero, _CMP_GT_OQ),
+                                                               _mm256_cmp_ps(tBatch, tLimit, _CMP_LE_OQ)));
+        __m256 onEdge = _mm256_or_ps(_mm256_cmp_ps(u, zero, _CMP_EQ_OQ),
+                                     _mm256_or_ps(_mm256_cmp_ps(v, zero, _CMP_EQ_OQ), _mm256_cmp_ps(w, zero, _CMP_EQ_OQ)));
+
+        // Lanes past the end of the range hold the next leaf's triangles, or padding
+        __m256 valid = _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(first + count - batch), laneIndex));
+        unsigned int candidates = _mm256_movemask_ps(_mm256_and_ps(_mm256_andnot_ps(onEdge, candidate), valid));
+        unsigned int edges = _mm256_movemask_ps(_mm256_and_ps(onEdge, valid));
+
+        for (; candidates; candidates &= candidates - 1)
+        {
+            // The float signs decided the ray goes through, only redo the numbers
+            size_t i = batch + __builtin_ctz(candidates);
+            Vector triangle[3];
+            vertices(i, triangle);
+            double thisU, thisV, thisW, tScaledDouble;
+            ray.project(triangle, thisU, thisV, thisW, tScaledDouble);
+            double thisDet = thisU + thisV + thisW;
+            if (thisDet == 0.0)
+            {
+                continue;
+            }
+            double thisT = tScaledDouble / thisDet;
+            if (thisT > EPSILON && thisT < tMax)
+            {
+                tMax = t = thisT;
+                beta = thisV / thisDet;
+                gamma = thisW / thisDet;
+                index = i;
+                hit = true;
+            }
+        }
+        for (; edges; edges &= edges - 1)
+        {
+            if (intersectEach(batch + __builtin_ctz(edges), 1, ray, tMax, t, beta, gamma, index))
+            {
+                tMax = t;
+                hit = true;
+            }
+        }
+        tLimit = _mm256_set1_ps(tMax * 1.001);
+    }
+    return hit;
+}
+#else
+bool TriangleBuffer::intersect(size_t first, size_t count, const WatertightRay &ray, double tMax,
+                               double &t, double &beta, double &gamma, uint32_t &index) const
+{
+    return intersectEach(first, count, ray, tMax, t, beta, gamma, index);
+}
+#endif
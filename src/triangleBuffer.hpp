@@ -0,0 +1,153 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <cmath>
+#include "vector.hpp"
+#include "ray.hpp"
+#include "boundingBox.hpp"
+#include "scene.hpp"
+#include "common.hpp"
+
+/**
+ * @brief A ray set up for the watertight ray/triangle test (Woop,
+ * Benthin and Wald, "Watertight Ray/Triangle Intersection", 2013).
+ * Triangles are moved so the ray starts at the origin and sheared so it
+ * points down +z. Then the test is three 2D edge functions, and two
+ * triangles sharing an edge compute exactly the same values along it,
+ * so no ray slips through the crack between them.
+ *
+ * The tests live in triangleBuffer.cpp, which is built without fused
+ * multiply-adds: they round the two sides of an edge differently.
+ */
+struct WatertightRay
+{
+    Vector mOrigin;
+    int mKx, mKy, mKz;    // Axes after permuting, mKz has the largest direction component
+    double mSx, mSy, mSz; // Shear that maps the direction to (0, 0, 1)
+
+    WatertightRay(const Ray &ray)
+    {
+        mOrigin = ray.mOrigin;
+        mKz = 0;
+        for (int i = 1; i < 3; i++)
+        {
+            if (std::abs(ray.mDir[i]) > std::abs(ray.mDir[mKz]))
+            {
+                mKz = i;
+            }
+        }
+        mKx = (mKz + 1) % 3;
+        mKy = (mKx + 1) % 3;
+        if (ray.mDir[mKz] < 0)
+        {
+            // Swapping x and y keeps the winding order the same
+            int swap = mKx;
+            mKx = mKy;
+            mKy = swap;
+        }
+        mSx = ray.mDir[mKx] / ray.mDir[mKz];
+        mSy = ray.mDir[mKy] / ray.mDir[mKz];
+        mSz = 1.0 / ray.mDir[mKz];
+    }
+
+    /**
+     * @brief Move and shear a triangle into the ray's space and work out
+     * its edge functions, without deciding anything.
+     *
+     * @param vertices Vertices, each indexed by axis
+     * @param u, v, w Edge functions opposite each vertex: scaled
+     * barycentric coordinates, all the same sign if the ray passes
+     * through the triangle
+     * @param tScaled Time t of the hit, times u + v + w
+     */
+    void project(const Vector vertices[3], double &u, double &v, double &w, double &tScaled) const;
+
+    /**
+     * @brief Test one triangle. Hits at or before EPSILON are ignored, so
+     * a ray doesn't hit the surface it just left.
+     *
+     * @param vertices Vertices, each indexed by axis
+     * @param t Time t of the collision
+     * @param beta, gamma Barycentric coordinates of vertices[1] and vertices[2]
+     * @return true if the ray hit the triangle
+     */
+    bool intersect(const Vector vertices[3], double &t, double &beta, double &gamma) const;
+};
+
+/**
+ * @brief Triangles laid out for intersection testing instead of
+ * shading: the three vertices, each stored as one float array per axis
+ * (structure of arrays). Half the size of double vectors, and a run of
+ * triangles is a run of memory in every array, so intersect() can load
+ * sBatchSize triangles into one AVX register each.
+ */
+class TriangleBuffer
+{
+public:
+    static constexpr int sBatchSize = 8; // Triangles tested together, and the most a mesh BVH leaf holds
+
+    // Each array has sBatchSize - 1 unused values at the end, so a batch
+    // starting at any triangle can be loaded whole
+    std::vector<float> mVertices[3][3]; // mVertices[vertex][axis]
+
+    TriangleBuffer();
+
+    /**
+     * @brief Copy triangles into the buffer, in the same order.
+     *
+     * @param modelMatrix If set, move the triangles into world space
+     * with it first
+     */
+    TriangleBuffer(const std::vector<object::Triangle> &triangles, const ModelMatrix *modelMatrix = NULL);
+
+    inline size_t size() const
+    {
+        return mSize;
+    }
+
+    /**
+     * @brief Bytes used by the arrays.
+     */
+    size_t memoryUsage() const;
+
+    /**
+     * @brief Bounds of triangle i, as stored (after rounding to float).
+     */
+    BoundingBox boundingBox(size_t i) const;
+
+    /**
+     * @brief Find the closest hit among triangles [first, first + count),
+     * sBatchSize at a time with AVX if the target has it. The batch test
+     * is single precision and decides which triangles the ray passes
+     * through, then the time and coordinates of those are worked out
+     * again in double. Where a float edge function comes out exactly 0
+     * the whole test is redone in double, like the paper does.
+     *
+     * @param tMax Only hits before this are looked for
+     * @param t, beta, gamma, index Closest hit: time, barycentric
+     * coordinates of v1 and v2, and the triangle
+     * @return true if the ray hit any of the triangles before tMax
+     */
+    bool intersect(size_t first, size_t count, const WatertightRay &ray, double tMax,
+                   double &t, double &beta, double &gamma, uint32_t &index) const;
+
+private:
+    size_t mSize;
+
+    inline void vertices(size_t i, Vector v[3]) const
+    {
+        for (int vertex = 0; vertex < 3; vertex++)
+        {
+            v[vertex] = Vector(mVertices[vertex][0][i], mVertices[vertex][1][i], mVertices[vertex][2][i]);
+        }
+    }
+
+    /**
+     * @brief Test triangles [first, first + count) one at a time in
+     * double precision, for targets without AVX.
+     */
+    bool intersectEach(size_t first, size_t count, const WatertightRay &ray, double tMax,
+                       double &t, double &beta, double &gamma, uint32_t &index) const;
+};
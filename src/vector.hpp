@@ -2,23 +2,87 @@
 
 #include <vector>
 #include <cstddef>
+#include <cmath>
+#include <stdexcept>
+#include "common.hpp"
+
+/**
+ * Header-only so every operation can be inlined into the hot loops.
+ *
+ * Vectors are padded to 4 lanes so they fit a SIMD register. The 4th
+ * lane is always 0, every operation has to keep it that way (dot()
+ * sums all 4 lanes).
+ *
+ * Scalar type is picked at compile time. Build with -DVECTOR_FLOAT
+ * (make PRECISION=float) for float vectors, otherwise double.
+ * - double + AVX: one __m256d
+ * - float + SSE: one __m128
+ * - anything else: plain scalar code
+ */
+#ifdef VECTOR_FLOAT
+typedef float scalar_t;
+#if defined(__SSE__)
+#define VECTOR_SSE
+#include <immintrin.h>
+#endif
+#else
+typedef double scalar_t;
+#if defined(__AVX__)
+#define VECTOR_AVX
+#include <immintrin.h>
+#endif
+#endif
 
 #define V_X (0)
 #define V_Y (1)
 #define V_Z (2)
 
-class Vector
+class alignas(4 * sizeof(scalar_t)) Vector
 {
 public:
-    double v[3];
+    union
+    {
+        scalar_t v[4];
+#if defined(VECTOR_AVX)
+        __m256d mSimd;
+#elif defined(VECTOR_SSE)
+        __m128 mSimd;
+#endif
+    };
+
+    inline Vector()
+    {
+        set(0, 0, 0);
+    }
+
+    inline Vector(std::vector<double> std_vector)
+    {
+        if (std_vector.size() != 3)
+        {
+            throw std::invalid_argument("Vector not of size 3.");
+        }
+        set(std_vector[0], std_vector[1], std_vector[2]);
+    }
+
+    inline Vector(scalar_t arr[3])
+    {
+        set(arr[0], arr[1], arr[2]);
+    }
+
+    inline Vector(scalar_t x, scalar_t y, scalar_t z)
+    {
+        set(x, y, z);
+    }
 
-    Vector();
-    Vector(std::vector<double> std_vector);
-    Vector(double double_arr[3]);
-    Vector(double x, double y, double z);
+    inline scalar_t &operator[](size_t index)
+    {
+        return v[index];
+    }
 
-    double &operator[](size_t index);
-    const double &operator[](size_t index) const;
+    inline const scalar_t &operator[](size_t index) const
+    {
+        return v[index];
+    }
 
     /**
      * NOTE!
@@ -32,15 +96,41 @@ public:
     /**
      * @brief 3-dimensional dot product of two vectors
      */
-    double dot(const Vector &a);
-    static double dot(const Vector &a, const Vector &b);
+    inline scalar_t dot(const Vector &a)
+    {
+        return dot(*this, a);
+    }
+    static inline scalar_t dot(const Vector &a, const Vector &b)
+    {
+#if defined(VECTOR_AVX)
+        __m256d m = _mm256_mul_pd(a.mSimd, b.mSimd);
+        __m128d s = _mm_add_pd(_mm256_castpd256_pd128(m), _mm256_extractf128_pd(m, 1)); // (x + z, y + 0)
+        return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+#elif defined(VECTOR_SSE)
+        __m128 m = _mm_mul_ps(a.mSimd, b.mSimd);
+        __m128 s = _mm_add_ps(m, _mm_movehl_ps(m, m)); // (x + z, y + 0, ...)
+        return _mm_cvtss_f32(_mm_add_ss(s, _mm_shuffle_ps(s, s, 1)));
+#else
+        return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+#endif
+    }
 
     /**
      * @brief 3-dimensional cross product of two vectors.
      * Performs this x a.
      */
-    Vector &cross3(const Vector &a);
-    Vector &cross3(const Vector &a, const Vector &b);
+    inline Vector &cross3(const Vector &a)
+    {
+        return cross3(*this, a);
+    }
+    inline Vector &cross3(const Vector &a, const Vector &b)
+    {
+        // Lane shuffles cost about as much as the scalar math here
+        set(a[1] * b[2] - a[2] * b[1],
+            -1.0 * (a[0] * b[2] - a[2] * b[0]),
+            a[0] * b[1] - a[1] * b[0]);
+        return *this;
+    }
     static inline Vector scross3(const Vector &a, const Vector &b)
     {
         Vector v;
@@ -50,8 +140,21 @@ public:
     /**
      * @brief 3-dimensional vector add
      */
-    Vector &vadd(const Vector &a);
-    Vector &vadd(const Vector &a, const Vector &b);
+    inline Vector &vadd(const Vector &a)
+    {
+        return vadd(*this, a);
+    }
+    inline Vector &vadd(const Vector &a, const Vector &b)
+    {
+#if defined(VECTOR_AVX)
+        mSimd = _mm256_add_pd(a.mSimd, b.mSimd);
+#elif defined(VECTOR_SSE)
+        mSimd = _mm_add_ps(a.mSimd, b.mSimd);
+#else
+        set(a[0] + b[0], a[1] + b[1], a[2] + b[2]);
+#endif
+        return *this;
+    }
     static inline Vector svadd(const Vector &a, const Vector &b)
     {
         Vector v;
@@ -62,8 +165,21 @@ public:
      * @brief 3-dimensional vector subtract.
      * Performs this - a.
      */
-    Vector &vsub(const Vector &a);
-    Vector &vsub(const Vector &a, const Vector &b);
+    inline Vector &vsub(const Vector &a)
+    {
+        return vsub(*this, a);
+    }
+    inline Vector &vsub(const Vector &a, const Vector &b)
+    {
+#if defined(VECTOR_AVX)
+        mSimd = _mm256_sub_pd(a.mSimd, b.mSimd);
+#elif defined(VECTOR_SSE)
+        mSimd = _mm_sub_ps(a.mSimd, b.mSimd);
+#else
+        set(a[0] - b[0], a[1] - b[1], a[2] - b[2]);
+#endif
+        return *this;
+    }
     static inline Vector svsub(const Vector &a, const Vector &b)
     {
         Vector v;
@@ -73,20 +189,99 @@ public:
     /**
      * @brief 3-dimensional vector multiply with a scalar
      */
-    Vector &vscale(double scalar);
-    Vector &vscale(const Vector &a, double scalar);
-    static inline Vector svscale(const Vector &a, double scalar)
+    inline Vector &vscale(scalar_t scalar)
+    {
+        return vscale(*this, scalar);
+    }
+    inline Vector &vscale(const Vector &a, scalar_t scalar)
+    {
+#if defined(VECTOR_AVX)
+        mSimd = _mm256_mul_pd(a.mSimd, _mm256_set1_pd(scalar));
+#elif defined(VECTOR_SSE)
+        mSimd = _mm_mul_ps(a.mSimd, _mm_set1_ps(scalar));
+#else
+        set(a[0] * scalar, a[1] * scalar, a[2] * scalar);
+#endif
+        return *this;
+    }
+    static inline Vector svscale(const Vector &a, scalar_t scalar)
     {
         Vector v;
         return v.vscale(a, scalar);
     }
 
+    /**
+     * @brief 3-dimensional element-wise multiply
+     */
+    inline Vector &vmul(const Vector &a)
+    {
+        return vmul(*this, a);
+    }
+    inline Vector &vmul(const Vector &a, const Vector &b)
+    {
+#if defined(VECTOR_AVX)
+        mSimd = _mm256_mul_pd(a.mSimd, b.mSimd);
+#elif defined(VECTOR_SSE)
+        mSimd = _mm_mul_ps(a.mSimd, b.mSimd);
+#else
+        set(a[0] * b[0], a[1] * b[1], a[2] * b[2]);
+#endif
+        return *this;
+    }
+    static inline Vector svmul(const Vector &a, const Vector &b)
+    {
+        Vector v;
+        return v.vmul(a, b);
+    }
+
+    /**
+     * @brief 3-dimensional element-wise min/max
+     */
+    inline Vector &vmin(const Vector &a)
+    {
+        return vmin(*this, a);
+    }
+    inline Vector &vmin(const Vector &a, const Vector &b)
+    {
+#if defined(VECTOR_AVX)
+        mSimd = _mm256_min_pd(a.mSimd, b.mSimd);
+#elif defined(VECTOR_SSE)
+        mSimd = _mm_min_ps(a.mSimd, b.mSimd);
+#else
+        set(MIN(a[0], b[0]), MIN(a[1], b[1]), MIN(a[2], b[2]));
+#endif
+        return *this;
+    }
+    inline Vector &vmax(const Vector &a)
+    {
+        return vmax(*this, a);
+    }
+    inline Vector &vmax(const Vector &a, const Vector &b)
+    {
+#if defined(VECTOR_AVX)
+        mSimd = _mm256_max_pd(a.mSimd, b.mSimd);
+#elif defined(VECTOR_SSE)
+        mSimd = _mm_max_ps(a.mSimd, b.mSimd);
+#else
+        set(MAX(a[0], b[0]), MAX(a[1], b[1]), MAX(a[2], b[2]));
+#endif
+        return *this;
+    }
+
     /**
      * @brief 3-dimensional vector norm. Attempting to normalize
      * the 0 vector returns the 0 vector.
      */
-    Vector &vnorm();
-    Vector &vnorm(const Vector &a);
+    inline Vector &vnorm()
+    {
+        return vnorm(*this);
+    }
+    inline Vector &vnorm(const Vector &a)
+    {
+        scalar_t mag = std::sqrt(dot(a, a));
+
+        return (mag != 0.0) ? vscale(a, 1.0 / mag) : *this;
+    }
     static inline Vector svnorm(const Vector &a)
     {
         Vector v;
@@ -97,9 +292,24 @@ public:
      * @brief Clamp all elements of a vector in the range [0, clip]
      * (inclusive).
      */
-    Vector &vclip(double clip);
-    Vector &vclip(const Vector &a, double clip);
-    static inline Vector svclip(const Vector &a, double clip)
+    inline Vector &vclip(scalar_t clip)
+    {
+        return vclip(*this, clip);
+    }
+    inline Vector &vclip(const Vector &a, scalar_t clip)
+    {
+#if defined(VECTOR_AVX)
+        mSimd = _mm256_min_pd(_mm256_max_pd(a.mSimd, _mm256_setzero_pd()), _mm256_set1_pd(clip));
+#elif defined(VECTOR_SSE)
+        mSimd = _mm_min_ps(_mm_max_ps(a.mSimd, _mm_setzero_ps()), _mm_set1_ps(clip));
+#else
+        set(CLAMP(a[0], 0, clip), CLAMP(a[1], 0, clip), CLAMP(a[2], 0, clip));
+#endif
+        // Padding lane would become clip if clip < 0
+        v[3] = 0;
+        return *this;
+    }
+    static inline Vector svclip(const Vector &a, scalar_t clip)
     {
         Vector v;
         return v.vclip(a, clip);
@@ -107,24 +317,83 @@ public:
 
     /**
      * @brief Return a random normalized 3-dimensional vector.
-     * Uses thread-safe C++ random number generation.
+     * Uses this thread's random number generator.
      */
-    Vector &vrand3();
+    inline Vector &vrand3()
+    {
+        v[0] = 2.0 * randomDouble() - 1.0;
+        v[1] = 2.0 * randomDouble() - 1.0;
+        v[2] = 2.0 * randomDouble() - 1.0;
+        return this->vnorm();
+    }
     static inline Vector svrand3()
     {
         Vector v;
         return v.vrand3();
     }
 
+    /**
+     * @brief Return a random normalized 3-dimensional vector, uniformly
+     * distributed over the unit sphere. Unlike vrand3(), there's no bias
+     * towards the corners of the cube.
+     */
+    inline Vector &vrandSphere3()
+    {
+        scalar_t u = randomDouble();
+        scalar_t v = randomDouble();
+        return vsphere3(u, v);
+    }
+    static inline Vector svrandSphere3()
+    {
+        Vector v;
+        return v.vrandSphere3();
+    }
+
+    /**
+     * @brief Map a point in [0, 1)^2 to a point on the unit sphere,
+     * keeping it uniform. vrandSphere3() with the random numbers given.
+     */
+    inline Vector &vsphere3(scalar_t u, scalar_t v)
+    {
+        scalar_t z = 2.0 * u - 1.0;
+        scalar_t phi = M_PI * (2.0 * v - 1.0);
+        scalar_t r = std::sqrt(MAX(1 - z * z, (scalar_t)0));
+        set(r * std::cos(phi), r * std::sin(phi), z);
+        return *this;
+    }
+    static inline Vector svsphere3(scalar_t u, scalar_t v)
+    {
+        Vector vec;
+        return vec.vsphere3(u, v);
+    }
+
     /**
      * @brief Returns true if all three of a vector's dimensions
      * are close to 0. False otherwise.
      */
-    bool closeToZero() const;
+    inline bool closeToZero() const
+    {
+        return CLOSE_TO(v[0], 0.0) && CLOSE_TO(v[1], 0.0) && CLOSE_TO(v[2], 0.0);
+    }
     static inline bool closeToZero(const Vector &a)
     {
         return a.closeToZero();
     }
+
+private:
+    inline void set(scalar_t x, scalar_t y, scalar_t z)
+    {
+#if defined(VECTOR_AVX)
+        mSimd = _mm256_setr_pd(x, y, z, 0.0);
+#elif defined(VECTOR_SSE)
+        mSimd = _mm_setr_ps(x, y, z, 0.0f);
+#else
+        v[0] = x;
+        v[1] = y;
+        v[2] = z;
+        v[3] = 0;
+#endif
+    }
 };
 
 class ModelMatrix
@@ -136,8 +405,21 @@ public:
     Vector mRight; // Model's +X axis
     Vector mScale;
 
-    ModelMatrix();
-    ModelMatrix(const Vector &origin, const Vector &front, const Vector &top, const Vector &scale);
+    inline ModelMatrix() {}
+    inline ModelMatrix(const Vector &origin, const Vector &front, const Vector &top, const Vector &scale)
+    {
+        mOrigin = origin;
+        mFront = front;
+        mTop = top;
+        mRight = Vector::scross3(Vector::svscale(mFront, -1.0), mTop);
+        mScale = scale;
+
+        // The basis never changes, so divide by |b_i|^2 once up front
+        mBasisScale = Vector(mScale[0] / Vector::dot(mRight, mRight),
+                             mScale[1] / Vector::dot(mTop, mTop),
+                             mScale[2] / Vector::dot(mFront, mFront));
+        mInvScale = Vector(1.0 / mScale[0], 1.0 / mScale[1], 1.0 / mScale[2]);
+    }
 
     /**
      * @brief Turn a 3-vector into a homogeneous 4-vector,
@@ -146,5 +428,58 @@ public:
      *
      * Modifies vec3 and returns a reference to vec3.
      */
-    Vector &mul(Vector &vec3) const;
+    inline Vector &mul(Vector &vec3) const
+    {
+        /*
+            Essentially this amounts to a change of basis,
+            translation, and scale. Doing it with discrete operations
+            instead of a single homogeneous matrix because
+            it's easier to write and performance is probably
+            close enough.
+
+            Little hack  for change of basis because top and
+            front are guaranteed to be orthogonal:
+            V_i = (V dot b_i) / |b_i|^2
+        */
+        // Handle rotation with change of basis, scale, then translation
+        Vector temp(Vector::dot(vec3, mRight), Vector::dot(vec3, mTop), Vector::dot(vec3, mFront));
+        vec3.vmul(temp, mBasisScale).vadd(mOrigin);
+        return vec3;
+    }
+
+    /**
+     * @brief Inverse of mul(). Takes a point in world space back
+     * into model space.
+     *
+     * Modifies vec3 and returns a reference to vec3.
+     */
+    inline Vector &mulInverse(Vector &vec3) const
+    {
+        // Undo translation, then the rest is the same as a direction
+        vec3.vsub(mOrigin);
+        return mulInverseDirection(vec3);
+    }
+
+    /**
+     * @brief Inverse of mul() for a direction. Undoes rotation and
+     * scale but not translation. The result is NOT normalized, so a
+     * ray transformed with mulInverse()/mulInverseDirection() has the
+     * same t values in both spaces.
+     *
+     * Modifies vec3 and returns a reference to vec3.
+     */
+    inline Vector &mulInverseDirection(Vector &vec3) const
+    {
+        // Undo scale, then undo the change of basis. The basis vectors are
+        // orthogonal, so V = sum(V_i * b_i).
+        Vector scaled = Vector::svmul(vec3, mInvScale);
+        vec3 = Vector::svscale(mRight, scaled[0]);
+        vec3.vadd(Vector::svscale(mTop, scaled[1]));
+        vec3.vadd(Vector::svscale(mFront, scaled[2]));
+        return vec3;
+    }
+
+private:
+    Vector mBasisScale; // mScale[i] / |b_i|^2
+    Vector mInvScale;   // 1 / mScale[i]
 };
@@ -0,0 +1,288 @@
+#include "wideBvh.hpp"
+
+#include <algorithm>
+
+/**
+ * @brief Surface area of a flat node's bounds, to decide which child
+ * to open up next.
+ */
+static float surfaceArea(const FlatBoundingVolumeHierarchy::Node &node)
+{
+    float x = node.mMax[0] - node.mMin[0];
+    float y = node.mMax[1] - node.mMin[1];
+    float z = node.mMax[2] - node.mMin[2];
+    return 2.0f * (x * y + y * z + z * x);
+}
+
+template <int Width>
+WideBoundingVolumeHierarchy<Width>::WideBoundingVolumeHierarchy(const FlatBoundingVolumeHierarchy &bvh)
+{
+    mPrimitives = bvh.mPrimitives;
+    if (!bvh.mNodes.empty())
+    {
+        collapse(bvh, 0);
+    }
+}
+
+template <int Width>
+uint32_t WideBoundingVolumeHierarchy<Width>::collapse(const FlatBoundingVolumeHierarchy &bvh, uint32_t flatIndex)
+{
+    uint32_t children[Width];
+    int count = 0;
+    const FlatBoundingVolumeHierarchy::Node &flatNode = bvh.mNodes[flatIndex];
+    if (flatNode.mCount > 0)
+    {
+        // Only happens at the root of a one leaf tree
+        children[count++] = flatIndex;
+    }
+    else
+    {
+        children[count++] = flatIndex + 1;
+        children[count++] = flatNode.mOffset;
+    }
+
+    // Replace the biggest interior child with its two children until
+    // the node is full or only has leaves left
+    while (count < Width)
+    {
+        int largest = -1;
+        float largestArea = -1;
+        for (int i = 0; i < count; i++)
+        {
+            const FlatBoundingVolumeHierarchy::Node &child = bvh.mNodes[children[i]];
+            if (child.mCount == 0 && surfaceArea(child) > largestArea)
+            {
+                largest = i;
+                largestArea = surfaceArea(child);
+            }
+        }
+        if (largest < 0)
+        {
+            break;
+        }
+        uint32_t opened = children[largest];
+        children[largest] = opened + 1;
+        children[count++] = bvh.mNodes[opened].mOffset;
+    }
+
+    // Children are appended after this node, mNodes may reallocate
+    // so don't hold references
+    uint32_t index = mNodes.size();
+    mNodes.emplace_back();
+    for (int c = 0; c < Width; c++)
+    {
+        if (c >= count)
+        {
+            for (int i = 0; i < 3; i++)
+            {
+                mNodes[index].mMin[i][c] = std::numeric_limits<float>::infinity();
+                mNodes[index].mMax[i][c] = -std::numeric_limits<float>::infinity();
+            }
+            mNodes[index].mChild[c] = 0;
+            mNodes[index].mCount[c] = 0;
+            continue;
+        }
+
+        const FlatBoundingVolumeHierarchy::Node &child = bvh.mNodes[children[c]];
+        for (int i = 0; i < 3; i++)
+        {
+            mNodes[index].mMin[i][c] = child.mMin[i];
+            mNodes[index].mMax[i][c] = child.mMax[i];
+        }
+        if (child.mCount > 0)
+        {
+            mNodes[index].mChild[c] = child.mOffset;
+            mNodes[index].mCount[c] = child.mCount;
+        }
+        else
+        {
+            uint32_t childIndex = collapse(bvh, children[c]);
+            mNodes[index].mChild[c] = childIndex;
+            mNodes[index].mCount[c] = 0;
+        }
+    }
+    return index;
+}
+
+template <int Width>
+bool WideBoundingVolumeHierarchy<Width>::closestHit(const Scene &scene, const Ray &incoming, object::Hit &hit, Stats *stats) const
+{
+    object::Hit thisHit;
+    auto leafTest = [&](uint32_t first, uint32_t count, double &closestT)
+    {
+        bool found = false;
+        for (uint32_t i = first; i < first + count; i++)
+        {
+            thisHit.mT = closestT;
+            if (scene.intersect(mPrimitives[i], incoming, thisHit) && thisHit.mT < closestT)
+            {
+                hit = thisHit;
+                closestT = thisHit.mT;
+                found = true;
+            }
+        }
+        return found;
+    };
+    double t = hit.mT;
+    return traverse(incoming, t, leafTest, stats);
+}
+
+template <int Width>
+bool WideBoundingVolumeHierarchy<Width>::occluded(const Scene &scene, const Ray &incoming, double tMax, Stats *stats) const
+{
+    object::Hit hit;
+    auto leafTest = [&](uint32_t first, uint32_t count, double &t)
+    {
+        for (uint32_t i = first; i < first + count; i++)
+        {
+            hit.mT = t;
+            if (scene.intersect(mPrimitives[i], incoming, hit) && hit.mT < t)
+            {
+                return true;
+            }
+        }
+        return false;
+    };
+    return traverse<true>(incoming, tMax, leafTest, stats);
+}
+
+template <int Width>
+uint32_t WideBoundingVolumeHierarchy<Width>::closestHitPacket(const Scene &scene, const Ray *rays, object::Hit *hits, int count, Stats *stats) const
+{
+    if (mNodes.empty() || count <= 1 || count > sMaxPacketSize)
+    {
+        return AccelerationStructure::closestHitPacket(scene, rays, hits, count, stats);
+    }
+    PackedRay packed[sMaxPacketSize];
+    double t[sMaxPacketSize];
+    for (int r = 0; r < count; r++)
+    {
+        packed[r] = PackedRay(rays[r]);
+        t[r] = hits[r].mT;
+        for (int i = 0; i < 3; i++)
+        {
+            if (packed[r].mNegative[i] != packed[0].mNegative[i])
+            {
+                return AccelerationStructure::closestHitPacket(scene, rays, hits, count, stats);
+            }
+        }
+    }
+
+    // Children still to visit, with the earliest time any of the rays
+    // that hit them enters them
+    struct Entry
+    {
+        uint32_t mChild;
+        uint32_t mCount;
+        float mT;
+        uint32_t mRays; // Bit mask of the rays that hit the child
+    };
+    Entry stack[sStackSize];
+    int stackSize = 0;
+    uint32_t hitMask = 0;
+    uint32_t active = (1u << count) - 1; // Rays to test against the current node
+    uint32_t index = 0;
+    object::Hit thisHit;
+    while (true)
+    {
+        const Node &node = mNodes[index];
+        const float *near[3], *far[3];
+        for (int i = 0; i < 3; i++)
+        {
+            near[i] = packed[0].mNegative[i] ? node.mMax[i] : node.mMin[i];
+            far[i] = packed[0].mNegative[i] ? node.mMin[i] : node.mMax[i];
+        }
+        uint32_t childRays[Width] = {};
+        float childT[Width];
+        std::fill(childT, childT + Width, std::numeric_limits<float>::infinity());
+        uint32_t entered = 0;
+        for (uint32_t remaining = active; remaining; remaining &= remaining - 1)
+        {
+            int r = __builtin_ctz(remaining);
+            float tEntry[Width];
+            unsigned int mask = slabTest(near, far, packed[r], roundUp(t[r]), tEntry, std::integral_constant<int, Width>());
+            entered |= (mask != 0) << r;
+            for (; mask; mask &= mask - 1)
+            {
+                int c = __builtin_ctz(mask);
+                childRays[c] |= 1u << r;
+                childT[c] = std::fmin(childT[c], tEntry[c]);
+            }
+        }
+        if (stats)
+        {
+            // Rays that miss the root never entered the tree
+            uint32_t counted = (index == 0) ? entered : active;
+            stats->mRays += (index == 0) ? __builtin_popcount(entered) : 0;
+            stats->mNodes += __builtin_popcount(counted);
+        }
+
+        // Insertion sort the children that were hit onto the stack,
+        // nearest on top
+        int first = stackSize;
+        for (int c = 0; c < Width; c++)
+        {
+            if (childRays[c] == 0)
+            {
+                continue;
+            }
+            Entry entry = {node.mChild[c], node.mCount[c], childT[c], childRays[c]};
+            int j = stackSize++;
+            while (j > first && stack[j - 1].mT < entry.mT)
+            {
+                stack[j] = stack[j - 1];
+                j--;
+            }
+            stack[j] = entry;
+        }
+
+        // Test leaves until the next interior node to visit
+        while (true)
+        {
+            if (stackSize == 0)
+            {
+                return hitMask;
+            }
+            const Entry &entry = stack[--stackSize];
+
+            // Drop rays that found a hit before any of them enter
+            uint32_t entryRays = 0;
+            for (uint32_t candidates = entry.mRays; candidates; candidates &= candidates - 1)
+            {
+                int r = __builtin_ctz(candidates);
+                entryRays |= (entry.mT <= t[r]) << r;
+            }
+            if (entryRays == 0)
+            {
+                continue;
+            }
+            if (entry.mCount == 0)
+            {
+                index = entry.mChild;
+                active = entryRays;
+                break;
+            }
+            for (; entryRays; entryRays &= entryRays - 1)
+            {
+                int r = __builtin_ctz(entryRays);
+                if (stats)
+                {
+                    stats->mPrimitives += entry.mCount;
+                }
+                for (uint32_t i = entry.mChild; i < entry.mChild + entry.mCount; i++)
+                {
+                    thisHit.mT = t[r];
+                    if (scene.intersect(mPrimitives[i], rays[r], thisHit) && thisHit.mT < t[r])
+                    {
+                        hits[r] = thisHit;
+                        t[r] = thisHit.mT;
+                        hitMask |= 1u << r;
+                    }
+                }
+            }
+        }
+    }
+}
+
+template class WideBoundingVolumeHierarchy<4>;
+template class WideBoundingVolumeHierarchy<8>;
@@ -0,0 +1,286 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <cmath>
+#include <limits>
+#include <type_traits>
+#include "ray.hpp"
+#include "scene.hpp"
+#include "flatBvh.hpp"
+#include "accelerationStructure.hpp"
+#if defined(__SSE__) || defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+/**
+ * @brief BVH with 4 or 8 children per node, made by collapsing a
+ * FlatBoundingVolumeHierarchy. Each node stores its children's bounds
+ * axis by axis (structure of arrays), so one SSE (4 wide) or AVX (8 wide)
+ * slab test checks a ray against every child at once. Falls back to a
+ * plain loop when the target has neither.
+ *
+ * Same queries as the flat tree, and the same primitive order, so it
+ * can be built from a cached flat tree at load time.
+ */
+template <int Width>
+class WideBoundingVolumeHierarchy : public AccelerationStructure
+{
+public:
+    static_assert(Width == 4 || Width == 8, "Wide BVHs are 4 or 8 wide");
+
+    // Every node visited can push all its children, but pops one
+    static constexpr int sStackSize = FlatBoundingVolumeHierarchy::sStackSize * (Width - 1) + 1;
+
+    struct alignas(32) Node
+    {
+        // Child bounds, copied from the flat tree so they're already
+        // rounded outwards. Unused child slots have inverted bounds
+        // (min inf, max -inf), which no ray can hit.
+        float mMin[3][Width];
+        float mMax[3][Width];
+        uint32_t mChild[Width]; // Leaf: index of the first primitive. Interior: index of the child node
+        uint32_t mCount[Width]; // Number of primitives in a leaf, 0 for interior nodes
+    };
+
+    std::vector<Node> mNodes;
+    std::vector<object::PrimitiveRef> mPrimitives;
+
+    /**
+     * @brief Collapse a binary tree. Each node takes the binary node's
+     * children, then keeps splitting whichever interior child has the
+     * largest surface area until it has Width children.
+     */
+    WideBoundingVolumeHierarchy(const FlatBoundingVolumeHierarchy &bvh);
+
+    bool closestHit(const Scene &scene, const Ray &incoming, object::Hit &hit, Stats *stats = NULL) const override;
+    bool occluded(const Scene &scene, const Ray &incoming, double tMax, Stats *stats = NULL) const override;
+
+    /**
+     * @brief Trace a packet with one shared stack. Every ray still
+     * looking for a hit is slab tested against a node's children, and a
+     * child is visited if any ray hits it. Rays that go different
+     * directions on an axis can't share near and far planes, so those
+     * packets are traced one ray at a time instead.
+     */
+    uint32_t closestHitPacket(const Scene &scene, const Ray *rays, object::Hit *hits, int count, Stats *stats = NULL) const override;
+
+    /**
+     * @brief Same as FlatBoundingVolumeHierarchy::traverse(). Children
+     * are pushed far to near, so they're visited front to back, and
+     * skipped when popped if the ray enters them after time t.
+     */
+    template <bool AnyHit = false, typename LeafTest>
+    bool traverse(const Ray &r, double &t, LeafTest leafTest, Stats *stats = NULL) const
+    {
+        if (mNodes.empty())
+        {
+            return false;
+        }
+        PackedRay ray(r);
+
+        // Children still to visit, with the time the ray enters them
+        struct Entry
+        {
+            uint32_t mChild;
+            uint32_t mCount;
+            float mT;
+        };
+        Entry stack[sStackSize];
+        int stackSize = 0;
+        bool hit = false;
+        uint32_t index = 0;
+        while (true)
+        {
+            const Node &node = mNodes[index];
+            float tEntry[Width];
+            unsigned int mask = intersectChildren(node, ray, roundUp(t), tEntry);
+            if (index == 0 && mask == 0)
+            {
+                // Missed the whole tree
+                return false;
+            }
+            if (stats)
+            {
+                stats->mRays += (index == 0);
+                stats->mNodes++;
+            }
+
+            // Insertion sort the children that were hit onto the stack,
+            // nearest on top
+            int first = stackSize;
+            while (mask)
+            {
+                int i = __builtin_ctz(mask);
+                mask &= mask - 1;
+                Entry entry = {node.mChild[i], node.mCount[i], tEntry[i]};
+                int j = stackSize++;
+                while (j > first && stack[j - 1].mT < entry.mT)
+                {
+                    stack[j] = stack[j - 1];
+                    j--;
+                }
+                stack[j] = entry;
+            }
+
+            // Test leaves until the next interior node to visit
+            while (true)
+            {
+                if (stackSize == 0)
+                {
+                    return hit;
+                }
+                const Entry &entry = stack[--stackSize];
+                if (entry.mT > t)
+                {
+                    // Enters after a hit found since it was pushed
+                    continue;
+                }
+                if (entry.mCount == 0)
+                {
+                    index = entry.mChild;
+                    break;
+                }
+                if (stats)
+                {
+                    stats->mPrimitives += entry.mCount;
+                }
+                if (leafTest(entry.mChild, entry.mCount, t))
+                {
+                    hit = true;
+                    if (AnyHit)
+                    {
+                        return true;
+                    }
+                }
+            }
+        }
+    }
+
+private:
+    // Ray in single precision with its inverse direction precomputed,
+    // so the slab test multiplies instead of dividing
+    struct PackedRay
+    {
+        float mOrigin[3];
+        float mInvDir[3];
+        bool mNegative[3]; // Direction is negative, near plane is the max
+
+        inline PackedRay() {}
+        inline PackedRay(const Ray &r)
+        {
+            for (int i = 0; i < 3; i++)
+            {
+                mOrigin[i] = r.mOrigin[i];
+                mInvDir[i] = 1.0f / (float)r.mDir[i];
+                mNegative[i] = std::signbit(mInvDir[i]);
+            }
+        }
+    };
+
+    // Float rounding in the slab test can put the exit just before the
+    // entry for a ray grazing a box. Pad the exit (PBRT's 1 + 2 * gamma(3)).
+    static constexpr float sExitScale = 1.0f + 2.0f * (3.0f * 0.5f * std::numeric_limits<float>::epsilon()) /
+                                                   (1.0f - 3.0f * 0.5f * std::numeric_limits<float>::epsilon());
+
+    /**
+     * @brief Collapse the subtree under a flat node into mNodes. Returns
+     * the index of the subtree's root node.
+     */
+    uint32_t collapse(const FlatBoundingVolumeHierarchy &bvh, uint32_t flatIndex);
+
+    /**
+     * @brief Round the closest hit time so far up to a float, so no box
+     * that should be visited gets culled by the rounding.
+     */
+    static inline float roundUp(double t)
+    {
+        float f = (float)t;
+        return f < t ? std::nextafter(f, std::numeric_limits<float>::infinity()) : f;
+    }
+
+    /**
+     * @brief Slab test against every child of a node. Same semantics as
+     * FlatBoundingVolumeHierarchy::intersectsNode(), for all children
+     * at once.
+     *
+     * @param tEntry Time the ray enters each child
+     * @return Bit mask of the children the ray hits
+     */
+    static inline unsigned int intersectChildren(const Node &node, const PackedRay &ray, float tMax, float tEntry[Width])
+    {
+        const float *near[3], *far[3];
+        for (int i = 0; i < 3; i++)
+        {
+            near[i] = ray.mNegative[i] ? node.mMax[i] : node.mMin[i];
+            far[i] = ray.mNegative[i] ? node.mMin[i] : node.mMax[i];
+        }
+        return slabTest(near, far, ray, tMax, tEntry, std::integral_constant<int, Width>());
+    }
+
+#if defined(__AVX__)
+    static inline unsigned int slabTest(const float *near[3], const float *far[3], const PackedRay &ray, float tMax, float *tEntry, std::integral_constant<int, 8>)
+    {
+        __m256 entry = _mm256_set1_ps(-std::numeric_limits<float>::infinity());
+        __m256 exit = _mm256_set1_ps(std::numeric_limits<float>::infinity());
+        for (int i = 0; i < 3; i++)
+        {
+            __m256 origin = _mm256_set1_ps(ray.mOrigin[i]);
+            __m256 invDir = _mm256_set1_ps(ray.mInvDir[i]);
+            entry = _mm256_max_ps(entry, _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(near[i]), origin), invDir));
+            exit = _mm256_min_ps(exit, _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(far[i]), origin), invDir));
+        }
+        exit = _mm256_mul_ps(exit, _mm256_set1_ps(sExitScale));
+        __m256 hit = _mm256_and_ps(_mm256_cmp_ps(entry, exit, _CMP_LE_OQ),
+                                   _mm256_and_ps(_mm256_cmp_ps(exit, _mm256_setzero_ps(), _CMP_GT_OQ),
+                                                 _mm256_cmp_ps(entry, _mm256_set1_ps(tMax), _CMP_LE_OQ)));
+        _mm256_storeu_ps(tEntry, entry);
+        return _mm256_movemask_ps(hit);
+    }
+#endif
+
+#if defined(__SSE__)
+    static inline unsigned int slabTest(const float *near[3], const float *far[3], const PackedRay &ray, float tMax, float *tEntry, std::integral_constant<int, 4>)
+    {
+        __m128 entry = _mm_set1_ps(-std::numeric_limits<float>::infinity());
+        __m128 exit = _mm_set1_ps(std::numeric_limits<float>::infinity());
+        for (int i = 0; i < 3; i++)
+        {
+            __m128 origin = _mm_set1_ps(ray.mOrigin[i]);
+            __m128 invDir = _mm_set1_ps(ray.mInvDir[i]);
+            entry = _mm_max_ps(entry, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(near[i]), origin), invDir));
+            exit = _mm_min_ps(exit, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(far[i]), origin), invDir));
+        }
+        exit = _mm_mul_ps(exit, _mm_set1_ps(sExitScale));
+        __m128 hit = _mm_and_ps(_mm_cmple_ps(entry, exit),
+                                _mm_and_ps(_mm_cmpgt_ps(exit, _mm_setzero_ps()),
+                                           _mm_cmple_ps(entry, _mm_set1_ps(tMax))));
+        _mm_storeu_ps(tEntry, entry);
+        return _mm_movemask_ps(hit);
+    }
+#endif
+
+    // Plain loop, for widths the target has no SIMD registers for
+    template <int W>
+    static inline unsigned int slabTest(const float *near[3], const float *far[3], const PackedRay &ray, float tMax, float *tEntry, std::integral_constant<int, W>)
+    {
+        unsigned int mask = 0;
+        for (int c = 0; c < W; c++)
+        {
+            float entry = -std::numeric_limits<float>::infinity();
+            float exit = std::numeric_limits<float>::infinity();
+            for (int i = 0; i < 3; i++)
+            {
+                entry = std::fmax(entry, (near[i][c] - ray.mOrigin[i]) * ray.mInvDir[i]);
+                exit = std::fmin(exit, (far[i][c] - ray.mOrigin[i]) * ray.mInvDir[i]);
+            }
+            exit *= sExitScale;
+            tEntry[c] = entry;
+            if (entry <= exit && exit > 0 && entry <= tMax)
+            {
+                mask |= 1u << c;
+            }
+        }
+        return mask;
+    }
+};
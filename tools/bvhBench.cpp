@@ -0,0 +1,190 @@
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "scene.hpp"
+#include "mesh.hpp"
+#include "bvh.hpp"
+#include "flatBvh.hpp"
+#include "wideBvh.hpp"
+#include "common.hpp"
+
+#define HELP                                                                      \
+    "COMS 336 Ray Tracing Renderer BVH benchmark\n"                               \
+    "usage: bvhBench [options]\n\n"                                               \
+    "Traces the same random rays through the binary, 4 wide and 8 wide BVHs of\n" \
+    "a scene and compares their speed. Rays start at random points inside the\n"  \
+    "scene's bounds and go in random directions, like bounced rays.\n\n"          \
+    "options:\n"                                                                  \
+    "-h                 Show this help message and exit\n"                        \
+    "-s [SCENE_JSON]    Scene file to benchmark. Default: scenes/sample.json\n"   \
+    "-b [BUILDER]       BVH split method, median or sah. Default: median\n"       \
+    "-n [RAYS]          Number of rays to trace. Default: 1000000\n"              \
+    "-S [SEED]          Random seed for the rays. Default: 1\n"                   \
+    "-j [JOBS]          Number of threads to build the BVHs with. Default: 1\n"
+
+/**
+ * @brief Random point in a box
+ */
+static Vector randomPoint(const BoundingBox &box)
+{
+    Vector point;
+    for (int i = 0; i < 3; i++)
+    {
+        point[i] = box.mMin[i] + randomDouble() * (box.mMax[i] - box.mMin[i]);
+    }
+    return point;
+}
+
+/**
+ * @brief Time closest hit and occlusion queries for one set of rays, and
+ * print a line of results.
+ *
+ * @param segmentEnds Ends of the occlusion query segments, one per ray
+ */
+static void benchmark(const std::string &name, const AccelerationStructure &bvh, const Scene &scene, const std::vector<Ray> &rays, const std::vector<double> &segmentEnds)
+{
+    AccelerationStructure::Stats stats;
+    uint64_t hits = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (const Ray &ray : rays)
+    {
+        object::Hit hit;
+        hit.mT = std::numeric_limits<double>::infinity();
+        hits += bvh.closestHit(scene, ray, hit, &stats);
+    }
+    double closestSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    uint64_t occluded = 0;
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < rays.size(); i++)
+    {
+        occluded += bvh.occluded(scene, rays[i], segmentEnds[i]);
+    }
+    double occludedSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << std::left << std::setw(10) << name << std::right << std::fixed << std::setprecision(2)
+              << std::setw(14) << rays.size() / closestSeconds / 1e6
+              << std::setw(14) << rays.size() / occludedSeconds / 1e6
+              << std::setw(12) << (double)stats.mNodes / rays.size()
+              << std::setw(12) << (double)stats.mPrimitives / rays.size()
+              << std::setw(10) << hits
+              << std::setw(10) << occluded << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    std::string scenePath = "scenes/sample.json";
+    BoundingVolumeHierarchy::SplitMethod splitMethod = BoundingVolumeHierarchy::MEDIAN;
+    size_t rayCount = 1000000;
+    uint64_t seed = 1;
+    int jobs = 1;
+    while ((opt = getopt(argc, argv, "hs:b:n:S:j:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'h':
+            std::cout << HELP << std::endl;
+            return 0;
+        case 's':
+            scenePath = std::string(optarg);
+            break;
+        case 'b':
+            splitMethod = BoundingVolumeHierarchy::stringToSplitMethod(std::string(optarg));
+            break;
+        case 'n':
+            rayCount = std::stoull(optarg);
+            break;
+        case 'S':
+            seed = std::stoull(optarg);
+            break;
+        case 'j':
+            jobs = (int)std::stoul(optarg);
+            break;
+        default:
+            return 1;
+        }
+    }
+
+    try
+    {
+        std::cout << "Building scene..." << std::endl;
+        auto buildStart = std::chrono::steady_clock::now();
+        Scene scene;
+        scene.load(scenePath, jobs);
+        std::vector<BoundingVolumeHierarchy::BuildPrimitive> primitives;
+        BoundingBox bounds = BoundingBox::empty();
+        for (object::PrimitiveRef ref : scene.primitives())
+        {
+            primitives.push_back({scene.primitive(ref).mBoundingBox, ref});
+            bounds.merge(scene.primitive(ref).mBoundingBox);
+        }
+        BoundingVolumeHierarchy *tree = new BoundingVolumeHierarchy(primitives, splitMethod, jobs); // Must be heap alloc
+        FlatBoundingVolumeHierarchy flatBvh(*tree);
+        delete tree;
+        scene.reorder(flatBvh.mPrimitives);
+        WideBoundingVolumeHierarchy<4> bvh4(flatBvh);
+        WideBoundingVolumeHierarchy<8> bvh8(flatBvh);
+        std::cout << "Built in " << std::chrono::duration<double>(std::chrono::steady_clock::now() - buildStart).count()
+                  << " seconds with " << jobs << " jobs." << std::endl;
+
+        // Volumes pick random scatter distances while intersecting,
+        // so seed the generator the renderer's random numbers come from
+        randGen.seed(seed);
+        std::vector<Ray> rays;
+        std::vector<double> segmentEnds;
+        for (size_t i = 0; i < rayCount; i++)
+        {
+            Vector from = randomPoint(bounds);
+            Vector to = randomPoint(bounds);
+            Vector dir = Vector::svsub(to, from);
+            double length = sqrt(Vector::dot(dir, dir));
+            rays.push_back(Ray(from, dir.vscale(1.0 / length)));
+            segmentEnds.push_back(length);
+        }
+
+        std::cout << "Tracing " << rayCount << " rays through " << flatBvh.mPrimitives.size() << " primitives." << std::endl;
+        std::cout << std::left << std::setw(10) << "BVH" << std::right
+                  << std::setw(14) << "closest Mr/s"
+                  << std::setw(14) << "occluded Mr/s"
+                  << std::setw(12) << "nodes/ray"
+                  << std::setw(12) << "prims/ray"
+                  << std::setw(10) << "hits"
+                  << std::setw(10) << "occluded" << std::endl;
+        for (std::unique_ptr<Mesh> &mesh : scene.mMeshes)
+        {
+            mesh->widen(2);
+        }
+        benchmark("binary", flatBvh, scene, rays, segmentEnds);
+        for (std::unique_ptr<Mesh> &mesh : scene.mMeshes)
+        {
+            mesh->widen(4);
+        }
+        benchmark("4 wide", bvh4, scene, rays, segmentEnds);
+        for (std::unique_ptr<Mesh> &mesh : scene.mMeshes)
+        {
+            mesh->widen(8);
+        }
+        benchmark("8 wide", bvh8, scene, rays, segmentEnds);
+        if (!scene.mModels.empty())
+        {
+            // Same again with every mesh instance in world space
+            scene.bakeModels(std::numeric_limits<size_t>::max());
+            for (std::unique_ptr<Mesh> &mesh : scene.mBakedMeshes)
+            {
+                mesh->widen(8);
+            }
+            benchmark("8 baked", bvh8, scene, rays, segmentEnds);
+        }
+    }
+    catch (const std::exception &e)
+    {
+        std::cout << "Exception " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
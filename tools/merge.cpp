@@ -0,0 +1,97 @@
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+#include "sampleBuffer.hpp"
+#include "hdrImage.hpp"
+
+#define HELP                                                                         \
+    "COMS 336 Ray Tracing Renderer sample merger\n"                                  \
+    "usage: merge [options] [SAMPLES]...\n\n"                                        \
+    "Adds up the .samples files saved by render -k, e.g. renders of the same\n"      \
+    "scene with different seeds, and saves the result like render does.\n\n"         \
+    "options:\n"                                                                     \
+    "-h                 Show this help message and exit\n"                           \
+    "-o [OUTPUT]        Output file path. Outputs [OUTPUT].samples, [OUTPUT].pfm,\n" \
+    "                       [OUTPUT].exr and [OUTPUT].ppm. Default: merged\n"        \
+    "-T [TONEMAP]       Tone mapping for the .ppm output, clamp, reinhard,\n"        \
+    "                       or aces. Default: clamp\n"
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    std::string outputPath = "merged";
+    HdrImage::ToneMap toneMap = HdrImage::CLAMP;
+    while ((opt = getopt(argc, argv, "ho:T:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'h':
+            std::cout << HELP << std::endl;
+            return 0;
+        case 'o':
+            outputPath = std::string(optarg);
+            break;
+        case 'T':
+            toneMap = HdrImage::stringToToneMap(std::string(optarg));
+            break;
+        default:
+            return 1;
+        }
+    }
+    if (optind >= argc)
+    {
+        std::cout << HELP << std::endl;
+        return 1;
+    }
+
+    try
+    {
+        SampleBuffer merged;
+        for (int i = optind; i < argc; i++)
+        {
+            std::ifstream in(argv[i], std::ios::in | std::ios::binary);
+            if (!in)
+            {
+                throw std::invalid_argument(std::string("Can't open ") + argv[i]);
+            }
+            SampleBuffer samples;
+            samples.read(in);
+            if (i == optind)
+            {
+                merged = std::move(samples);
+            }
+            else if (samples.mWidth != merged.mWidth || samples.mHeight != merged.mHeight)
+            {
+                throw std::invalid_argument(std::string(argv[i]) + " is a different resolution");
+            }
+            else
+            {
+                merged.merge(samples);
+            }
+            std::cout << "Merged " << argv[i] << std::endl;
+        }
+
+        std::ofstream out(outputPath + ".samples", std::ios::out | std::ios::binary);
+        merged.write(out);
+        out.close();
+
+        HdrImage hdr = merged.average();
+        hdr.writePfm(outputPath + ".pfm");
+        hdr.writeExr(outputPath + ".exr");
+
+        std::vector<uint8_t> fb(hdr.mPixels.size());
+        hdr.toneMap(toneMap, fb.data());
+        out.open(outputPath + ".ppm", std::ios::out | std::ios::binary);
+        out << "P6\n"
+            << hdr.mWidth << " " << hdr.mHeight << "\n255\n";
+        out.write((const char *)fb.data(), fb.size());
+        out.close();
+    }
+    catch (const std::exception &e)
+    {
+        std::cout << "Exception " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}